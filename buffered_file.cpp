@@ -0,0 +1,210 @@
+#include "buffered_file.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// alignment of buffers, file offsets and lengths for direct io
+static const size_t block_len = 4096;
+
+buffered_file::buffered_file(const std::string& path, size_t buffer_len, bool direct)
+: fd_(-1)
+, direct_(direct)
+, regular_(true)
+, buffer_len_((buffer_len + block_len - 1) / block_len * block_len)
+, buffers_()
+, active_(0)
+, offset_(0)
+, allocated_(0)
+, lock_()
+, changed_()
+, pending_(-1)
+, pending_len_(0)
+, pending_tail_(false)
+, stop_(false)
+, failed_(false)
+, thread_()
+{
+    // direct io is for files, not pipes or devices
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && !S_ISREG(st.st_mode))
+        direct_ = false;
+
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (direct_)
+    {
+        fd_ = open(path.c_str(), flags | O_DIRECT, 0644);
+        if (fd_ == -1 && errno == EINVAL)
+            direct_ = false;
+    }
+    if (!direct_)
+        fd_ = open(path.c_str(), flags, 0644);
+    if (fd_ == -1)
+        throw std::invalid_argument(std::string("could not create file: ") + strerror(errno));
+    regular_ = fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+
+    for (buffer& b : buffers_)
+    {
+        void* p = nullptr;
+        if (posix_memalign(&p, block_len, buffer_len_))
+        {
+            for (buffer& allocated : buffers_)
+                free(allocated.data);
+            ::close(fd_);
+            throw std::invalid_argument(std::string("could not allocate output buffers"));
+        }
+        b.data = static_cast<char*>(p);
+        b.used = 0;
+    }
+    thread_ = std::thread(&buffered_file::flush_thread, this);
+}
+
+buffered_file::~buffered_file()
+{
+    close();
+    for (buffer& b : buffers_)
+        free(b.data);
+}
+
+bool buffered_file::write(const void* data, size_t len)
+{
+    const char* p = static_cast<const char*>(data);
+    while (len)
+    {
+        buffer& b = buffers_[active_];
+        const size_t n = std::min(len, buffer_len_ - b.used);
+        memcpy(b.data + b.used, p, n);
+        b.used += n;
+        p += n;
+        len -= n;
+        if (b.used == buffer_len_)
+            submit(false);
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    return !failed_;
+}
+
+void buffered_file::wait_idle(std::unique_lock<std::mutex>& guard)
+{
+    changed_.wait(guard, [&]{ return pending_ == -1; });
+}
+
+void buffered_file::submit(bool tail)
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    wait_idle(guard);
+
+    buffer& b = buffers_[active_];
+    buffer& next = buffers_[active_ ^ 1];
+    // direct io can only write whole blocks until the tail, the rest
+    // starts the next buffer
+    const size_t len = (direct_ && !tail) ? b.used - b.used % block_len : b.used;
+    next.used = b.used - len;
+    memcpy(next.data, b.data + len, next.used);
+    if (len || tail)
+    {
+        pending_ = active_;
+        pending_len_ = len;
+        pending_tail_ = tail;
+        changed_.notify_all();
+    }
+    b.used = 0;
+    active_ ^= 1;
+}
+
+bool buffered_file::flush()
+{
+    if (fd_ == -1)
+        return false;
+    submit(false);
+    std::unique_lock<std::mutex> guard(lock_);
+    wait_idle(guard);
+    return !failed_;
+}
+
+bool buffered_file::close()
+{
+    if (fd_ == -1)
+        return false;
+    submit(true);
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        wait_idle(guard);
+        stop_ = true;
+        changed_.notify_all();
+    }
+    thread_.join();
+
+    // drop any space preallocated past the end
+    if (regular_ && ftruncate(fd_, offset_) != 0)
+        failed_ = true;
+    if (::close(fd_) != 0)
+        failed_ = true;
+    fd_ = -1;
+    return !failed_;
+}
+
+bool buffered_file::write_out(const char* data, size_t len)
+{
+    while (len)
+    {
+        // a pipe cannot seek, so it is written at its current position
+        const ssize_t n = regular_ ? pwrite(fd_, data, len, offset_) : ::write(fd_, data, len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+        offset_ += n;
+    }
+    return true;
+}
+
+void buffered_file::flush_thread()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while (true)
+    {
+        changed_.wait(guard, [&]{ return pending_ != -1 || stop_; });
+        if (pending_ == -1)
+            return;
+        const char* data = buffers_[pending_].data;
+        size_t len = pending_len_;
+        const bool tail = pending_tail_;
+        guard.unlock();
+
+        // reserve space a few buffers ahead without changing the file size,
+        // not all file systems can
+        if (regular_ && offset_ + len > allocated_)
+        {
+            const uint64_t step = 4 * buffer_len_;
+            if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, offset_, step) == 0)
+                allocated_ = offset_ + step;
+            else
+                allocated_ = UINT64_MAX;
+        }
+
+        bool ok = true;
+        if (tail && direct_ && len % block_len)
+        {
+            // whole blocks directly, then the rest through the page cache
+            const size_t whole = len - len % block_len;
+            ok = write_out(data, whole);
+            data += whole;
+            len -= whole;
+            ok = ok && fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT) == 0;
+        }
+        ok = ok && write_out(data, len);
+
+        guard.lock();
+        if (!ok)
+            failed_ = true;
+        pending_ = -1;
+        changed_.notify_all();
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Output file written in large blocks from a background thread.
+ * Data is copied into one of two aligned buffers; once it fills, it is
+ * handed to the flush thread and the other buffer is filled meanwhile.
+ * Space is preallocated ahead of the writes, and with direct io every
+ * write but the final tail is a whole number of aligned blocks.
+ * A pipe or device is written in order, without direct io or preallocation.
+ */
+struct buffered_file
+{
+    // will throw if the file cannot be created, direct io falls back to
+    // buffered io where the file system does not support it
+    buffered_file(const std::string& path, size_t buffer_len, bool direct);
+    ~buffered_file();
+
+    buffered_file(const buffered_file&) = delete;
+    void operator=(const buffered_file&) = delete;
+
+    // false once a write to the file has failed
+    bool write(const void* data, size_t len);
+
+    // wait until everything written so far is in the file, except with
+    // direct io up to the last whole block; false on a write error
+    bool flush();
+
+    // write the tail and close, also done by the destructor
+    bool close();
+
+    bool direct() const { return direct_; }
+
+private:
+    struct buffer
+    {
+        char* data;
+        size_t used;
+    };
+
+    void submit(bool tail);
+    void wait_idle(std::unique_lock<std::mutex>& guard);
+    void flush_thread();
+    bool write_out(const char* data, size_t len);
+
+    int fd_;
+    bool direct_;
+    // a regular file, rather than a pipe or device written in order
+    bool regular_;
+    const size_t buffer_len_;
+    buffer buffers_[2];
+    // buffer being filled by write()
+    unsigned active_;
+    // offset of the next byte written to the file, by the flush thread
+    uint64_t offset_;
+    uint64_t allocated_;
+
+    std::mutex lock_;
+    std::condition_variable changed_;
+    // buffer handed to the flush thread, -1 if it is idle
+    int pending_;
+    // bytes of the pending buffer to write, and whether it is the tail
+    size_t pending_len_;
+    bool pending_tail_;
+    bool stop_;
+    bool failed_;
+    std::thread thread_;
+};
@@ -1,9 +1,20 @@
 #include "crc32.hpp"
+#include <string.h>
+#include <vector>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#include <arm_acle.h>
+#endif
 
 /* Copyright (C) 1986 Gary S. Brown.  You may use this program, or
  * code or tables extracted from it, as desired without restriction. */
 
-static uint32_t crc32_tab[] = {
+static const uint32_t crc32_tab[] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
     0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
     0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
@@ -49,15 +60,261 @@ static uint32_t crc32_tab[] = {
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
-uint32_t crc32(uint32_t crc, const void *buf, uint64_t size)
+/*
+ * All kernels work on the pre-inverted crc state, the public entry points
+ * do the inversion.
+ */
+
+static uint32_t crc32_bytes(uint32_t state, const uint8_t* p, uint64_t size)
+{
+    while (size--)
+        state = crc32_tab[(state ^ *p++) & 0xFF] ^ (state >> 8);
+    return state;
+}
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+/*
+ * Slicing tables: entry [k][i] is the crc of byte i followed by k zero bytes,
+ * so 8 or 16 bytes can be folded into the state with independent lookups.
+ */
+struct crc32_slice_tables
+{
+    uint32_t t[16][256];
+
+    crc32_slice_tables()
+    {
+        for (unsigned i = 0; i < 256; ++i)
+        {
+            t[0][i] = crc32_tab[i];
+            for (unsigned k = 1; k < 16; ++k)
+                t[k][i] = (t[k-1][i] >> 8) ^ crc32_tab[t[k-1][i] & 0xFF];
+        }
+    }
+};
+
+static const crc32_slice_tables& slice_tables()
+{
+    static const crc32_slice_tables tables;
+    return tables;
+}
+
+static uint32_t crc32_slice8(uint32_t state, const uint8_t* p, uint64_t size)
+{
+    const uint32_t (&t)[16][256] = slice_tables().t;
+    while (size >= 8)
+    {
+        uint32_t a, b;
+        memcpy(&a, p, 4);
+        memcpy(&b, p + 4, 4);
+        a ^= state;
+        state = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF] ^ t[4][a >> 24]
+              ^ t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF] ^ t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
+        p += 8;
+        size -= 8;
+    }
+    return crc32_bytes(state, p, size);
+}
+
+static uint32_t crc32_slice16(uint32_t state, const uint8_t* p, uint64_t size)
 {
-    const uint8_t *p;
+    const uint32_t (&t)[16][256] = slice_tables().t;
+    while (size >= 16)
+    {
+        uint32_t a, b, c, d;
+        memcpy(&a, p, 4);
+        memcpy(&b, p + 4, 4);
+        memcpy(&c, p + 8, 4);
+        memcpy(&d, p + 12, 4);
+        a ^= state;
+        state = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^ t[13][(a >> 16) & 0xFF] ^ t[12][a >> 24]
+              ^ t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^ t[9][(b >> 16) & 0xFF] ^ t[8][b >> 24]
+              ^ t[7][c & 0xFF] ^ t[6][(c >> 8) & 0xFF] ^ t[5][(c >> 16) & 0xFF] ^ t[4][c >> 24]
+              ^ t[3][d & 0xFF] ^ t[2][(d >> 8) & 0xFF] ^ t[1][(d >> 16) & 0xFF] ^ t[0][d >> 24];
+        p += 16;
+        size -= 16;
+    }
+    return crc32_slice8(state, p, size);
+}
+#else
+// slicing tables assume little endian loads
+#define crc32_slice8 crc32_bytes
+#define crc32_slice16 crc32_bytes
+#endif
+
+#if defined(__x86_64__)
+/*
+ * Carry-less multiply folding, from Intel's "Fast CRC Computation for
+ * Generic Polynomials Using PCLMULQDQ Instruction", using the bit
+ * reflected constants for the ethernet polynomial.
+ * Folds 64 bytes per iteration, size must be a multiple of 16 and >= 64.
+ */
+__attribute__((target("sse2,pclmul")))
+static uint32_t crc32_fold(uint32_t state, const uint8_t* p, uint64_t size)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(state));
+    p += 64;
+    size -= 64;
 
-    p = (const uint8_t*) buf;
-    crc = crc ^ ~0U;
+    // fold 4 x 128 bits in parallel
+    while (size >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30)));
+        p += 64;
+        size -= 64;
+    }
 
+    // fold down to 128 bits
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // single folds of any remaining 16 byte blocks
+    while (size >= 16)
+    {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        p += 16;
+        size -= 16;
+    }
+
+    // fold 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+static uint32_t crc32_pclmul(uint32_t state, const uint8_t* p, uint64_t size)
+{
+    if (size >= 64)
+    {
+        uint64_t blocks = size & ~uint64_t(15);
+        state = crc32_fold(state, p, blocks);
+        p += blocks;
+        size -= blocks;
+    }
+    return crc32_slice8(state, p, size);
+}
+
+static bool have_pclmul()
+{
+    unsigned a, b, c, d;
+    return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_PCLMUL);
+}
+#endif
+
+#if defined(__aarch64__)
+__attribute__((target("+crc")))
+static uint32_t crc32_armv8(uint32_t state, const uint8_t* p, uint64_t size)
+{
+    while (size >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        state = __crc32d(state, v);
+        p += 8;
+        size -= 8;
+    }
     while (size--)
-        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        state = __crc32b(state, *p++);
+    return state;
+}
 
-    return crc ^ ~0U;
+static bool have_armv8_crc()
+{
+    return getauxval(AT_HWCAP) & HWCAP_CRC32;
+}
+#endif
+
+template <uint32_t (*kernel)(uint32_t, const uint8_t*, uint64_t)>
+static uint32_t crc32_entry(uint32_t crc, const void *buf, uint64_t size)
+{
+    return kernel(crc ^ ~0U, static_cast<const uint8_t*>(buf), size) ^ ~0U;
+}
+
+static std::vector<crc32_kernel> find_kernels()
+{
+    std::vector<crc32_kernel> kernels;
+    kernels.push_back({"byte", crc32_entry<crc32_bytes>});
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    kernels.push_back({"slice8", crc32_entry<crc32_slice8>});
+    kernels.push_back({"slice16", crc32_entry<crc32_slice16>});
+#endif
+#if defined(__x86_64__)
+    if (have_pclmul())
+        kernels.push_back({"pclmul", crc32_entry<crc32_pclmul>});
+#elif defined(__aarch64__)
+    if (have_armv8_crc())
+        kernels.push_back({"armv8", crc32_entry<crc32_armv8>});
+#endif
+    return kernels;
+}
+
+static const std::vector<crc32_kernel>& kernels()
+{
+    static const std::vector<crc32_kernel> supported = find_kernels();
+    return supported;
+}
+
+const crc32_kernel* crc32_kernels(size_t& count)
+{
+    count = kernels().size();
+    return kernels().data();
+}
+
+const char* crc32_kernel_name()
+{
+    return kernels().back().name;
+}
+
+uint32_t crc32(uint32_t crc, const void *buf, uint64_t size)
+{
+    static const crc32_fn fastest = kernels().back().fn;
+    return fastest(crc, buf, size);
 }
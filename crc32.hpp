@@ -1,6 +1,21 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
+// dispatches to the fastest kernel supported by the cpu
 uint32_t crc32(uint32_t crc, const void *buf, uint64_t size);
 
+typedef uint32_t (*crc32_fn)(uint32_t crc, const void *buf, uint64_t size);
+
+struct crc32_kernel
+{
+    const char* name;
+    crc32_fn fn;
+};
+
+// kernels supported by this cpu, slowest first, for testing and benchmarking
+const crc32_kernel* crc32_kernels(size_t& count);
+
+// name of the kernel used by crc32()
+const char* crc32_kernel_name();
@@ -0,0 +1,342 @@
+#include "decompress_buf.hpp"
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef WITH_ZSTD
+#include <zstd.h>
+#endif
+
+static bool ends_with(const std::string& s, const std::string& suffix)
+{
+    return s.size() > suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+decompress_buf::format_t decompress_buf::format(const std::string& path)
+{
+    if (ends_with(path, ".gz"))
+        return gzip;
+    if (ends_with(path, ".zst"))
+        return zstd;
+    return none;
+}
+
+decompress_buf::decompress_buf(const std::string& path, format_t format,
+                               size_t buffer_len, size_t buffers)
+: format_(format)
+, buffer_len_(buffer_len)
+, fd_(-1)
+, wake_fd_(-1)
+, input_(format == none ? nullptr : new char[input_len])
+, input_pos_(0)
+, input_end_(0)
+, stream_end_(false)
+, stream_(nullptr)
+, error_()
+, buffers_(buffers)
+, lock_()
+, changed_()
+, ready_(0)
+, tail_(0)
+, holding_(false)
+, done_(false)
+, stop_(false)
+, thread_()
+{
+    switch (format_)
+    {
+    case gzip:
+#ifndef WITH_ZLIB
+        throw std::invalid_argument("built without gzip support (could not find <zlib.h>)");
+#endif
+        break;
+    case zstd:
+#ifndef WITH_ZSTD
+        throw std::invalid_argument("built without zstd support (could not find <zstd.h>)");
+#endif
+        break;
+    default:
+        break;
+    }
+
+    fd_ = path == "-" ? dup(STDIN_FILENO) : open(path.c_str(), O_RDONLY);
+    if (fd_ == -1)
+        throw std::invalid_argument(std::string("could not open file: ") + strerror(errno));
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    wake_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd_ == -1)
+    {
+        close(fd_);
+        throw std::invalid_argument(std::string("could not create eventfd: ") + strerror(errno));
+    }
+
+#ifdef WITH_ZLIB
+    if (format_ == gzip)
+    {
+        z_stream* z = new z_stream();
+        // 32 added to the window bits detects gzip or zlib headers
+        if (inflateInit2(z, 15 + 32) == Z_OK)
+            stream_ = z;
+        else
+            delete z;
+    }
+#endif
+#ifdef WITH_ZSTD
+    if (format_ == zstd)
+        stream_ = ZSTD_createDStream();
+#endif
+    if (format_ != none && !stream_)
+    {
+        close(fd_);
+        close(wake_fd_);
+        throw std::invalid_argument("could not set up decompression");
+    }
+
+    for (buffer& b : buffers_)
+    {
+        b.data.reset(new char[buffer_len_]);
+        b.len = 0;
+    }
+    thread_ = std::thread(&decompress_buf::decompress_thread, this);
+}
+
+decompress_buf::~decompress_buf()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    changed_.notify_all();
+    const uint64_t wake = 1;
+    if (write(wake_fd_, &wake, sizeof(wake)) != sizeof(wake))
+        std::cerr << "Problem stopping input thread: " << strerror(errno) << std::endl;
+    if (thread_.joinable())
+        thread_.join();
+
+#ifdef WITH_ZLIB
+    if (format_ == gzip && stream_)
+    {
+        inflateEnd(static_cast<z_stream*>(stream_));
+        delete static_cast<z_stream*>(stream_);
+    }
+#endif
+#ifdef WITH_ZSTD
+    if (format_ == zstd && stream_)
+        ZSTD_freeDStream(static_cast<ZSTD_DStream*>(stream_));
+#endif
+    stream_ = nullptr;
+    close(fd_);
+    close(wake_fd_);
+}
+
+bool decompress_buf::wait_ready(size_t len, unsigned timeout_ms)
+{
+    if (size_t(egptr() - gptr()) >= len)
+        return true;
+    std::unique_lock<std::mutex> guard(lock_);
+    return changed_.wait_for(guard, std::chrono::milliseconds(timeout_ms),
+                             [this] { return ready_ > (holding_ ? 1u : 0u) || done_; });
+}
+
+bool decompress_buf::peek(void* data, size_t len) const
+{
+    if (size_t(egptr() - gptr()) < len)
+        return false;
+    memcpy(data, gptr(), len);
+    return true;
+}
+
+decompress_buf::int_type decompress_buf::underflow()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    if (holding_)
+    {
+        // hand the buffer just read back to be filled again
+        holding_ = false;
+        --ready_;
+        tail_ = (tail_ + 1) % buffers_.size();
+        changed_.notify_all();
+    }
+    changed_.wait(guard, [this] { return ready_ || done_; });
+    if (!ready_)
+    {
+        setg(nullptr, nullptr, nullptr);
+        if (!error_.empty())
+        {
+            std::cerr << "Problem reading input: " << error_ << std::endl;
+            throw std::runtime_error(error_);
+        }
+        return traits_type::eof();
+    }
+
+    buffer& b = buffers_[tail_];
+    holding_ = true;
+    setg(b.data.get(), b.data.get(), b.data.get() + b.len);
+    return traits_type::to_int_type(*gptr());
+}
+
+void decompress_buf::decompress_thread()
+{
+    size_t head = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            changed_.wait(guard, [this] { return ready_ < buffers_.size() || stop_; });
+            if (stop_)
+                return;
+        }
+
+        // only this thread touches buffers the reader has not been given
+        buffer& b = buffers_[head];
+        b.len = 0;
+        const int more = fill(b);
+
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            if (b.len)
+            {
+                ++ready_;
+                head = (head + 1) % buffers_.size();
+            }
+            if (more <= 0)
+                done_ = true;
+        }
+        changed_.notify_all();
+        if (more <= 0)
+            return;
+    }
+}
+
+int decompress_buf::fill(buffer& out)
+{
+    while (out.len < buffer_len_)
+    {
+        if (format_ == none)
+        {
+            const ssize_t n = read_some(&out.data[out.len], buffer_len_ - out.len);
+            if (n <= 0)
+                return n;
+            out.len += n;
+        }
+        else if (input_pos_ == input_end_)
+        {
+            if (!read_input())
+                return -1;
+            if (input_pos_ == input_end_)
+            {
+                if (!stream_end_)
+                {
+                    error_ = "compressed input is truncated";
+                    return -1;
+                }
+                return 0;
+            }
+        }
+        else if (!(format_ == gzip ? inflate_step(out) : zstd_step(out)))
+            return -1;
+
+        // a slow source is handed over as it arrives
+        if (out.len && reader_waiting())
+            return 1;
+    }
+    return 1;
+}
+
+bool decompress_buf::reader_waiting()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    return ready_ == (holding_ ? 1u : 0u);
+}
+
+ssize_t decompress_buf::read_some(char* data, size_t len)
+{
+    pollfd fds[2] = { { fd_, POLLIN, 0 }, { wake_fd_, POLLIN, 0 } };
+    while (true)
+    {
+        // a pipe may block indefinitely, so wait until it is readable or
+        // the buffer is being destroyed
+        if (poll(fds, 2, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            error_ = strerror(errno);
+            return -1;
+        }
+        if (fds[1].revents)
+            return -1;
+        const ssize_t n = read(fd_, data, len);
+        if (n == -1 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (n == -1)
+            error_ = strerror(errno);
+        return n;
+    }
+}
+
+bool decompress_buf::read_input()
+{
+    input_pos_ = 0;
+    const ssize_t n = read_some(input_.get(), input_len);
+    input_end_ = n > 0 ? n : 0;
+    return n >= 0;
+}
+
+bool decompress_buf::inflate_step(buffer& out)
+{
+#ifdef WITH_ZLIB
+    z_stream* z = static_cast<z_stream*>(stream_);
+    // more input after a complete member is the next member of the file
+    stream_end_ = false;
+    z->next_in = reinterpret_cast<Bytef*>(&input_[input_pos_]);
+    z->avail_in = input_end_ - input_pos_;
+    z->next_out = reinterpret_cast<Bytef*>(&out.data[out.len]);
+    z->avail_out = buffer_len_ - out.len;
+    const int ret = inflate(z, Z_NO_FLUSH);
+    input_pos_ = input_end_ - z->avail_in;
+    out.len = buffer_len_ - z->avail_out;
+
+    if (ret == Z_STREAM_END)
+    {
+        stream_end_ = true;
+        inflateReset(z);
+    }
+    else if (ret != Z_OK && ret != Z_BUF_ERROR)
+    {
+        error_ = z->msg ? z->msg : "corrupt gzip input";
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool decompress_buf::zstd_step(buffer& out)
+{
+#ifdef WITH_ZSTD
+    ZSTD_inBuffer in = { &input_[0], input_end_, input_pos_ };
+    ZSTD_outBuffer to = { &out.data[0], buffer_len_, out.len };
+    const size_t ret = ZSTD_decompressStream(static_cast<ZSTD_DStream*>(stream_), &to, &in);
+    if (ZSTD_isError(ret))
+    {
+        error_ = ZSTD_getErrorName(ret);
+        return false;
+    }
+    input_pos_ = in.pos;
+    out.len = to.pos;
+    // zero once a frame is complete, further frames follow on
+    stream_end_ = ret == 0;
+    return true;
+#else
+    return false;
+#endif
+}
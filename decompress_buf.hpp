@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Stream buffer reading a file, pipe or stdin ahead of the reader, and
+ * decompressing gzip or zstd on the way. A thread of its own reads in large
+ * blocks into a ring of buffers, which the reader takes in turn; the thread
+ * keeps filling the buffers the reader is not using, so it stays ahead of
+ * decoding whenever it can keep up, and hands over what it has so far when
+ * the reader would otherwise wait on a slow source.
+ */
+struct decompress_buf : public std::streambuf
+{
+    enum format_t
+    {
+        none,
+        gzip,
+        zstd,
+    };
+
+    // format from the file name, .gz or .zst
+    static format_t format(const std::string& path);
+
+    // path - is stdin; will throw if the file cannot be opened, or the
+    // format is not supported by this build
+    decompress_buf(const std::string& path, format_t format,
+                   size_t buffer_len = 4 << 20, size_t buffers = 4);
+    ~decompress_buf();
+
+    decompress_buf(const decompress_buf&) = delete;
+    void operator=(const decompress_buf&) = delete;
+
+    // wait up to timeout_ms until len bytes can likely be read without
+    // blocking, true if they can or the input has ended
+    bool wait_ready(size_t len, unsigned timeout_ms);
+
+    // copy the next len bytes without consuming them, false if they are
+    // not all in the buffer being read
+    bool peek(void* data, size_t len) const;
+
+protected:
+    // the next decompressed buffer, throws on corrupt or truncated input
+    // so the stream reports an error rather than the end of the file
+    int_type underflow() override;
+
+private:
+    // compressed bytes read from the file at once
+    static const size_t input_len = 1 << 20;
+
+    struct buffer
+    {
+        std::unique_ptr<char[]> data = nullptr;
+        size_t len = 0;
+    };
+
+    void decompress_thread();
+    // 1 if the buffer was filled, 0 at the end of the input, -1 on error
+    int fill(buffer& out);
+    // bytes read, 0 at the end of the input, -1 on error or once stopped
+    ssize_t read_some(char* data, size_t len);
+    bool read_input();
+    // the reader has nothing queued beyond the buffer it is using
+    bool reader_waiting();
+    bool inflate_step(buffer& out);
+    bool zstd_step(buffer& out);
+
+    const format_t format_;
+    const size_t buffer_len_;
+    int fd_;
+    // signalled to stop a read blocked on a pipe
+    int wake_fd_;
+    std::unique_ptr<char[]> input_;
+    size_t input_pos_;
+    size_t input_end_;
+    // the last gzip member or zstd frame is complete
+    bool stream_end_;
+    // decompressor state of the format, gzip z_stream or ZSTD_DStream
+    void* stream_;
+    std::string error_;
+
+    std::vector<buffer> buffers_;
+    std::mutex lock_;
+    std::condition_variable changed_;
+    // buffers filled and not yet released by the reader, from tail_, the
+    // first of which the reader is using while holding_
+    size_t ready_;
+    size_t tail_;
+    bool holding_;
+    bool done_;
+    bool stop_;
+    std::thread thread_;
+};
@@ -0,0 +1,308 @@
+#ifdef WITH_EXANIC_EMULATOR
+#include "exanic_emulator.hpp"
+#include "record_reader.hpp"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+// repeats of a capture replayed at its own timing follow on after this
+static const uint64_t repeat_gap_ns = 1000000;
+// bytes of preamble, start of frame and inter frame gap on the wire
+static const size_t frame_overhead = 20;
+
+struct exanic_emulated_device
+{
+    exanic_t handle = exanic_t();
+    // the time of the latest frame written on any port
+    std::atomic<uint64_t> clock_ns{0};
+};
+
+struct exanic_emulated_rx
+{
+    struct frame
+    {
+        size_t offset;
+        uint32_t len;
+        uint64_t time_ns;
+    };
+
+    exanic_rx_t handle = exanic_rx_t();
+    // capture replayed, payloads back to back in data
+    std::vector<char> data = std::vector<char>();
+    std::vector<frame> frames = std::vector<frame>();
+    double gbps = 0;
+    unsigned repeat = 1;
+    int verbose = 0;
+    std::atomic<bool> started{false};
+    std::atomic<bool> stop{false};
+    std::atomic<bool> done{false};
+    std::thread thread = std::thread();
+    // read once the thread is joined
+    uint64_t frames_written = 0;
+    uint64_t bytes_written = 0;
+    double seconds = 0;
+};
+
+exanic_t* exanic_acquire_handle(const char* device_name)
+{
+    exanic_emulated_device* device = new exanic_emulated_device();
+    device->handle.emulated = device;
+    return &device->handle;
+}
+
+void exanic_release_handle(exanic_t* exanic)
+{
+    delete exanic->emulated;
+}
+
+int exanic_find_port_by_interface_name(const char* name, char* device, size_t device_len,
+                                       int* port_number)
+{
+    return -1;
+}
+
+int exanic_get_interface_name(exanic_t* exanic, int port_number, char* name, size_t name_len)
+{
+    return -1;
+}
+
+int exanic_get_promiscuous_mode(exanic_t* exanic, int port_number)
+{
+    // there is no interface to change
+    return 1;
+}
+
+int exanic_get_port_stats(exanic_t* exanic, int port_number, exanic_port_stats_t* port_stats)
+{
+    memset(port_stats, 0, sizeof(*port_stats));
+    return 0;
+}
+
+exanic_rx_t* exanic_acquire_rx_buffer(exanic_t* exanic, int port_number, int buffer_number)
+{
+    void* ring = aligned_alloc(4096, sizeof(rx_chunk) * EXANIC_RX_NUM_CHUNKS);
+    if (!ring)
+        return nullptr;
+
+    // as if the ring was filled on the lap before the first, so the reader
+    // waits for generation 0 and catches up to chunk 0
+    rx_chunk* chunks = static_cast<rx_chunk*>(ring);
+    for (size_t i = 0; i < EXANIC_RX_NUM_CHUNKS; ++i)
+    {
+        memset(&chunks[i], 0, sizeof(rx_chunk));
+        chunks[i].u.info.length = 1;
+        chunks[i].u.info.generation = 255;
+    }
+
+    exanic_emulated_rx* rx = new exanic_emulated_rx();
+    rx->handle.exanic = exanic;
+    rx->handle.port_number = port_number;
+    rx->handle.buffer_number = buffer_number;
+    rx->handle.buffer = chunks;
+    rx->handle.next_chunk = 0;
+    rx->handle.generation = 0;
+    rx->handle.emulated = rx;
+    return &rx->handle;
+}
+
+void exanic_release_rx_buffer(exanic_rx_t* rx)
+{
+    exanic_emulated_rx* e = rx->emulated;
+    e->stop = true;
+    if (e->thread.joinable())
+    {
+        e->thread.join();
+        if (e->verbose)
+        {
+            const double seconds = e->seconds > 0 ? e->seconds : 1e-9;
+            std::cout << "ExaNIC emulator: replayed " << e->frames_written << " frames of "
+                      << e->bytes_written << " bytes in " << e->seconds << "s, "
+                      << e->bytes_written * 8 / seconds / 1e9 << " Gbps, "
+                      << e->frames_written / seconds / 1e6 << " Mpps" << std::endl;
+        }
+    }
+    free(const_cast<rx_chunk*>(rx->buffer));
+    delete e;
+}
+
+void __exanic_rx_catchup(exanic_rx_t* rx)
+{
+    volatile rx_chunk* ring = rx->buffer;
+    while (true)
+    {
+        // chunks before the first of an older generation were written on
+        // the current lap, the producer writes that chunk next
+        const uint8_t first = ring[0].u.info.generation;
+        uint32_t next = 0;
+        uint8_t generation = first + 1;
+        for (uint32_t i = 1; i < EXANIC_RX_NUM_CHUNKS; ++i)
+        {
+            if (ring[i].u.info.generation != first)
+            {
+                next = i;
+                generation = first;
+                break;
+            }
+        }
+
+        // resume only at the start of a frame
+        const uint32_t last = (next + EXANIC_RX_NUM_CHUNKS - 1) % EXANIC_RX_NUM_CHUNKS;
+        if (ring[last].u.info.length)
+        {
+            rx->next_chunk = next;
+            rx->generation = generation;
+            return;
+        }
+        std::this_thread::yield();
+    }
+}
+
+exanic_cycles_t exanic_timestamp_to_counter(exanic_t* exanic, exanic_cycles32_t timestamp)
+{
+    const uint64_t now = exanic->emulated->clock_ns.load(std::memory_order_acquire);
+    return now - uint32_t(uint32_t(now) - timestamp);
+}
+
+static void write_frame(exanic_rx_t* rx, uint32_t& next, uint8_t& generation,
+                        const char* data, size_t len, uint32_t timestamp)
+{
+    while (len)
+    {
+        volatile rx_chunk& chunk = rx->buffer[next];
+        const size_t n = len < EXANIC_RX_CHUNK_PAYLOAD_SIZE ? len : EXANIC_RX_CHUNK_PAYLOAD_SIZE;
+        memcpy(const_cast<char*>(chunk.payload), data, n);
+
+        rx_chunk_info info;
+        info.timestamp = timestamp;
+        info.frame_status = EXANIC_RX_FRAME_OK;
+        info.length = len == n ? n : 0;
+        info.matched_filter = 0;
+        info.generation = generation;
+        uint64_t word;
+        memcpy(&word, &info, sizeof(word));
+        // the payload must be visible before the generation that marks it
+        std::atomic_thread_fence(std::memory_order_release);
+        chunk.u.data = word;
+
+        data += n;
+        len -= n;
+        if (++next == EXANIC_RX_NUM_CHUNKS)
+        {
+            next = 0;
+            ++generation;
+        }
+    }
+}
+
+static void replay_thread(exanic_rx_t* rx)
+{
+    using clock = std::chrono::steady_clock;
+    exanic_emulated_rx& e = *rx->emulated;
+    std::atomic<uint64_t>& device_clock = rx->exanic->emulated->clock_ns;
+
+    uint32_t next = 0;
+    uint8_t generation = 0;
+    const uint64_t first = e.frames.front().time_ns;
+    const uint64_t span = e.frames.back().time_ns - first;
+    const double ns_per_byte = e.gbps > 0 ? 8 / e.gbps : 0;
+    double link_ns = 0;
+
+    // the link comes up once the reader is polling
+    while (!e.started && !e.stop)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    const clock::time_point start = clock::now();
+
+    for (unsigned r = 0; r < e.repeat && !e.stop; ++r)
+    {
+        for (const exanic_emulated_rx::frame& f : e.frames)
+        {
+            // time since the first frame, on the wire at the line rate or
+            // as captured
+            uint64_t offset;
+            if (ns_per_byte)
+            {
+                offset = link_ns;
+                link_ns += (f.len + frame_overhead) * ns_per_byte;
+            }
+            else
+                offset = r * (span + repeat_gap_ns) + (f.time_ns > first ? f.time_ns - first : 0);
+
+            // sleep through long gaps, spin through short ones
+            const clock::time_point due = start + std::chrono::nanoseconds(offset);
+            clock::time_point now;
+            while ((now = clock::now()) < due && !e.stop)
+            {
+                if (due - now > std::chrono::milliseconds(1))
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (e.stop)
+                break;
+
+            // the clock moves on before the frame is visible, so the reader
+            // never sees a timestamp ahead of it
+            const uint64_t time_ns = first + offset;
+            uint64_t latest = device_clock.load(std::memory_order_relaxed);
+            while (latest < time_ns
+                   && !device_clock.compare_exchange_weak(latest, time_ns, std::memory_order_release))
+                ;
+
+            write_frame(rx, next, generation, &e.data[f.offset], f.len, uint32_t(time_ns));
+            ++e.frames_written;
+            e.bytes_written += f.len;
+        }
+    }
+
+    e.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    e.done.store(true, std::memory_order_release);
+}
+
+void exanic_emulator_replay(exanic_rx_t* rx, const read_options& opt)
+{
+    exanic_emulated_rx& e = *rx->emulated;
+    if (opt.emulate.empty())
+        throw std::invalid_argument("a capture to replay must be given with --emulate");
+
+    read_options file_opt;
+    file_opt.source = opt.emulate;
+    std::unique_ptr<record_reader> reader = record_reader::pcap(file_opt);
+    std::vector<char> buffer(1 << 18);
+    while (true)
+    {
+        const read_record_t record = reader->next(buffer.data(), buffer.size());
+        if (record.status == read_record_t::again)
+            continue;
+        if (record.status == read_record_t::eof)
+            break;
+        if (record.status != read_record_t::ok)
+            throw std::invalid_argument("could not read capture to replay");
+        if (!record.len_capture)
+            continue;
+
+        e.frames.push_back({ e.data.size(), record.len_capture, uint64_t(record.clock_time.ns()) });
+        e.data.insert(e.data.end(), record.data, record.data + record.len_capture);
+    }
+    if (e.frames.empty())
+        throw std::invalid_argument("capture to replay is empty");
+
+    e.gbps = opt.emulate_gbps;
+    e.repeat = opt.emulate_repeat;
+    e.verbose = opt.verbose;
+    e.thread = std::thread(replay_thread, rx);
+}
+
+bool exanic_emulator_poll(exanic_rx_t* rx)
+{
+    exanic_emulated_rx& e = *rx->emulated;
+    if (!e.started)
+        e.started = true;
+    // a frame written just before the replay ended is still to be read
+    return e.done.load(std::memory_order_acquire)
+        && rx->buffer[rx->next_chunk].u.info.generation != rx->generation;
+}
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+/*
+ * In memory stand in for the parts of libexanic the ExaNIC reader uses, so
+ * the receive path can be benchmarked and its lapping recovery exercised
+ * without a card. Built with make EXANIC_EMULATOR=1, which compiles the
+ * reader against this header instead of <exanic/...>.
+ *
+ * Each receive buffer is a ring of EXANIC_RX_NUM_CHUNKS chunks laid out as
+ * the card's: a payload followed by the length, status, timestamp and
+ * generation of the chunk, the generation counting laps of the ring and
+ * written last. A producer thread replays a capture into the ring at the
+ * capture's own timing or at a line rate, stamping each frame with the low
+ * 32 bits of the device clock in ns. The device clock starts at the time of
+ * the first record of the capture and follows the replay, so emulated
+ * captures do not carry real times.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "options.hpp"
+
+#define EXANIC_RX_NUM_CHUNKS 16384
+#define EXANIC_RX_CHUNK_PAYLOAD_SIZE 120
+
+#define EXANIC_RX_FRAME_OK 0
+#define EXANIC_RX_FRAME_CORRUPT 1
+#define EXANIC_RX_FRAME_ABORTED 2
+#define EXANIC_RX_FRAME_HWOVFL 3
+#define EXANIC_RX_FRAME_SWOVFL 256
+#define EXANIC_RX_FRAME_TRUNCATED 257
+#define EXANIC_RX_FRAME_ERROR_MASK 0x0F
+
+typedef uint64_t exanic_cycles_t;
+typedef uint32_t exanic_cycles32_t;
+
+struct rx_chunk_info
+{
+    uint32_t timestamp;
+    uint8_t frame_status;
+    // bytes in the last chunk of a frame, zero for the chunks before it
+    uint8_t length;
+    uint8_t matched_filter;
+    uint8_t generation;
+};
+
+struct rx_chunk
+{
+    char payload[EXANIC_RX_CHUNK_PAYLOAD_SIZE];
+    union
+    {
+        struct rx_chunk_info info;
+        uint64_t data;
+    } u;
+};
+
+struct exanic_emulated_device;
+struct exanic_emulated_rx;
+
+typedef struct exanic
+{
+    exanic_emulated_device* emulated;
+} exanic_t;
+
+typedef struct exanic_rx
+{
+    exanic_t* exanic;
+    int port_number;
+    int buffer_number;
+    volatile struct rx_chunk* buffer;
+    uint32_t next_chunk;
+    uint8_t generation;
+    exanic_emulated_rx* emulated;
+} exanic_rx_t;
+
+exanic_t* exanic_acquire_handle(const char* device_name);
+void exanic_release_handle(exanic_t* exanic);
+
+// no interfaces have names, ports are given as device:port
+int exanic_find_port_by_interface_name(const char* name, char* device, size_t device_len,
+                                       int* port_number);
+int exanic_get_interface_name(exanic_t* exanic, int port_number, char* name, size_t name_len);
+int exanic_get_promiscuous_mode(exanic_t* exanic, int port_number);
+
+typedef struct exanic_port_stats
+{
+    uint32_t tx_count;
+    uint32_t rx_count;
+    uint32_t rx_ignored_count;
+    uint32_t rx_error_count;
+    uint32_t rx_dropped_count;
+} exanic_port_stats_t;
+
+// all zero, the emulated port never drops frames
+int exanic_get_port_stats(exanic_t* exanic, int port_number, exanic_port_stats_t* port_stats);
+
+exanic_rx_t* exanic_acquire_rx_buffer(exanic_t* exanic, int port_number, int buffer_number);
+void exanic_release_rx_buffer(exanic_rx_t* rx);
+
+// resume at the chunk the producer writes next, once it is at the end of
+// a frame, after the reader has been lapped
+void __exanic_rx_catchup(exanic_rx_t* rx);
+
+// the device clock in ns nearest before a frame stamped with timestamp
+exanic_cycles_t exanic_timestamp_to_counter(exanic_t* exanic, exanic_cycles32_t timestamp);
+
+// replay opt.emulate into the ring once the reader polls; will throw if the capture
+// cannot be read
+void exanic_emulator_replay(exanic_rx_t* rx, const read_options& opt);
+
+// called when the reader finds no new frame; the replay starts at the first
+// call, so frames are not lost while the reader is set up. True once the
+// replay has finished and every frame written has been received
+bool exanic_emulator_poll(exanic_rx_t* rx);
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include "../crc32.hpp"
+
+/**
+ * Compare the throughput of each crc32 kernel supported by this cpu
+ * over a range of ethernet frame sizes, after checking that all kernels
+ * agree with the byte at a time reference.
+ */
+
+static bool verify(const crc32_kernel* kernels, size_t count)
+{
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data(16384 + 16);
+    for (auto& c : data)
+        c = rng();
+
+    bool ok = true;
+    for (size_t len = 0; len <= 9216; len += (len < 256)? 1 : 61)
+    {
+        for (size_t align = 0; align < 8; align += 3)
+        {
+            const uint32_t expect = kernels[0].fn(0, &data[align], len);
+            for (size_t k = 1; k < count; ++k)
+            {
+                if (kernels[k].fn(0, &data[align], len) != expect)
+                {
+                    std::cerr << kernels[k].name << ": mismatch for " << len
+                              << " bytes at alignment " << align << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = 0;
+    const crc32_kernel* kernels = crc32_kernels(count);
+
+    if (!verify(kernels, count))
+        return 1;
+
+    // enough frames to exceed the l2 cache, so a run sees realistic loads
+    const size_t pool_len = 8 << 20;
+    std::vector<char> pool(pool_len);
+    std::mt19937 rng(2);
+    for (auto& c : pool)
+        c = rng();
+
+    const size_t sizes[] = { 64, 128, 256, 512, 1024, 1518, 4096, 9000 };
+
+    std::cout << "crc32 default kernel: " << crc32_kernel_name() << "\n\n";
+    std::cout << std::setw(8) << "bytes";
+    for (size_t k = 0; k < count; ++k)
+        std::cout << std::setw(10) << kernels[k].name;
+    std::cout << "   (GB/s)" << std::endl;
+
+    for (size_t len : sizes)
+    {
+        std::cout << std::setw(8) << len;
+        for (size_t k = 0; k < count; ++k)
+        {
+            using bench_clock = std::chrono::steady_clock;
+            uint32_t sink = 0;
+            uint64_t bytes = 0;
+            const bench_clock::time_point start = bench_clock::now();
+            bench_clock::duration elapsed;
+            do
+            {
+                for (size_t off = 0; off + len <= pool_len; off += len)
+                    sink ^= kernels[k].fn(0, &pool[off], len);
+                bytes += (pool_len / len) * len;
+                elapsed = bench_clock::now() - start;
+            }
+            while (elapsed < std::chrono::milliseconds(200));
+
+            const double secs = std::chrono::duration<double>(elapsed).count();
+            std::cout << std::setw(10) << std::fixed << std::setprecision(2)
+                      << (bytes / secs / 1e9);
+            // stop the compiler discarding the loop
+            if (sink == 0x12345678)
+                std::cout << ' ';
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
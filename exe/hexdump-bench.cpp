@@ -0,0 +1,102 @@
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <string>
+#include <vector>
+#include "../hexdump.hpp"
+
+/**
+ * Compare the throughput of each hexdump kernel supported by this cpu
+ * over a range of ethernet frame sizes, after checking that all kernels
+ * produce the same text as the scalar reference.
+ */
+
+static bool verify(const hexdump_kernel* kernels, size_t count)
+{
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data(16384 + 16);
+    for (auto& c : data)
+        c = rng();
+
+    bool ok = true;
+    for (size_t len = 0; len <= 9216; len += (len < 256)? 1 : 61)
+    {
+        for (size_t align = 0; align < 8; align += 3)
+        {
+            std::string expect_dump(hexdump_len(len), '\0');
+            std::string expect_hex(2 * len, '\0');
+            expect_dump.resize(kernels[0].dump(&data[align], len, &expect_dump[0]));
+            kernels[0].encode(&data[align], len, &expect_hex[0]);
+            for (size_t k = 1; k < count; ++k)
+            {
+                std::string dump(hexdump_len(len), '\0');
+                std::string hex(2 * len, '\0');
+                dump.resize(kernels[k].dump(&data[align], len, &dump[0]));
+                kernels[k].encode(&data[align], len, &hex[0]);
+                if (dump != expect_dump || hex != expect_hex)
+                {
+                    std::cerr << kernels[k].name << ": mismatch for " << len
+                              << " bytes at alignment " << align << std::endl;
+                    ok = false;
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = 0;
+    const hexdump_kernel* kernels = hexdump_kernels(count);
+
+    if (!verify(kernels, count))
+        return 1;
+
+    // enough frames to exceed the l2 cache, so a run sees realistic loads
+    const size_t pool_len = 8 << 20;
+    std::vector<char> pool(pool_len);
+    std::mt19937 rng(2);
+    for (auto& c : pool)
+        c = rng();
+
+    const size_t sizes[] = { 64, 128, 256, 512, 1024, 1518, 4096, 9000 };
+    std::vector<char> out(hexdump_len(9000));
+
+    std::cout << "hexdump default kernel: " << hexdump_kernel_name() << "\n\n";
+    std::cout << std::setw(8) << "bytes";
+    for (size_t k = 0; k < count; ++k)
+        std::cout << std::setw(10) << kernels[k].name;
+    std::cout << "   (input GB/s)" << std::endl;
+
+    for (size_t len : sizes)
+    {
+        std::cout << std::setw(8) << len;
+        for (size_t k = 0; k < count; ++k)
+        {
+            using bench_clock = std::chrono::steady_clock;
+            size_t sink = 0;
+            uint64_t bytes = 0;
+            const bench_clock::time_point start = bench_clock::now();
+            bench_clock::duration elapsed;
+            do
+            {
+                for (size_t off = 0; off + len <= pool_len; off += len)
+                    sink += kernels[k].dump(&pool[off], len, &out[0]);
+                bytes += (pool_len / len) * len;
+                elapsed = bench_clock::now() - start;
+            }
+            while (elapsed < std::chrono::milliseconds(200));
+
+            const double secs = std::chrono::duration<double>(elapsed).count();
+            std::cout << std::setw(10) << std::fixed << std::setprecision(2)
+                      << (bytes / secs / 1e9);
+            // stop the compiler discarding the loop
+            if (sink == 0x12345678 || out[0] == 1)
+                std::cout << ' ';
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <thread>
+#include <signal.h>
+#include "../shared_counters.hpp"
+
+/**
+ * Show the live counters a timestamp-decoder run with --counters publishes,
+ * with rates over each interval, until it exits.
+ */
+
+static volatile sig_atomic_t g_running = 1;
+
+static void signal_handler(int signal)
+{
+    g_running = 0;
+}
+
+static void usage(char* exe)
+{
+    std::cout << "Usage: " << exe << " <name> [<seconds>]\n"
+              << "Show the counters a timestamp-decoder run with --counters <name>\n"
+              << "publishes, every 1 or the given number of seconds until it exits,\n"
+              << "or once if the interval is 0." << std::endl;
+}
+
+static void print(const uint64_t (&now)[shared_counters::counters],
+                  const uint64_t (&last)[shared_counters::counters], double seconds)
+{
+    // rates are shown once there is an interval to take them over
+    auto rate = [&](size_t counter, double scale, const char* unit)
+    {
+        if (seconds > 0)
+            std::cout << " (" << (now[counter] - last[counter]) / seconds / scale << unit << ")";
+    };
+
+    std::cout << std::fixed << std::setprecision(0)
+              << "packets in " << now[shared_counters::packets_in];
+    rate(shared_counters::packets_in, 1, "/s");
+    std::cout << ", out " << now[shared_counters::packets_out];
+    rate(shared_counters::packets_out, 1, "/s");
+    std::cout << std::setprecision(2)
+              << ", bytes in " << now[shared_counters::bytes_in];
+    rate(shared_counters::bytes_in, 1e6, " MB/s");
+    std::cout << ", out " << now[shared_counters::bytes_out];
+    rate(shared_counters::bytes_out, 1e6, " MB/s");
+    for (size_t i = shared_counters::key_frames; i < shared_counters::counters; ++i)
+    {
+        // only the decode errors that happened are shown
+        if (i < shared_counters::status_errors || now[i])
+            std::cout << ", " << shared_counters::name(i) << ' ' << now[i];
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 3 || argv[1][0] == '-')
+    {
+        usage(argv[0]);
+        return argc == 2 ? 0 : -1;
+    }
+    const double interval_s = argc == 3 ? std::atof(argv[2]) : 1;
+
+    std::unique_ptr<shared_counters> counters;
+    try
+    {
+        counters = shared_counters::open(argv[1]);
+    }
+    catch (std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    // a decoder killed part way through an update leaves no consistent
+    // counts, anything else is retried
+    auto read = [&](uint64_t (&values)[shared_counters::counters])
+    {
+        while (!counters->read(values))
+        {
+            if (!g_running)
+                return false;
+            if (counters->ended())
+            {
+                std::cerr << "counters /dev/shm/" << argv[1]
+                          << " were left part way through an update" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    };
+
+    using clock = std::chrono::steady_clock;
+    uint64_t last[shared_counters::counters];
+    if (!read(last))
+        return -1;
+    clock::time_point last_time = clock::now();
+    if (interval_s <= 0)
+    {
+        print(last, last, 0);
+        return 0;
+    }
+
+    bool running = true;
+    while (running && g_running)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(interval_s));
+        // the final counts are still mapped once the decoder has exited
+        running = !counters->ended();
+
+        uint64_t now[shared_counters::counters];
+        if (!read(now))
+            return -1;
+        const clock::time_point now_time = clock::now();
+        print(now, last, std::chrono::duration<double>(now_time - last_time).count());
+        std::copy(now, now + shared_counters::counters, last);
+        last_time = now_time;
+    }
+    return 0;
+}
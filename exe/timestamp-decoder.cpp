@@ -1,12 +1,32 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
 #include <sstream>
+#include <vector>
 #include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include "../options.hpp"
 #include "../record_reader.hpp"
 #include "../record_process.hpp"
 #include "../record_writer.hpp"
+#include "../record_batch.hpp"
+#include "../record_pipeline.hpp"
+#include "../record_parallel.hpp"
+#include "../record_merge.hpp"
+#include "../record_sort.hpp"
+#include "../record_external_sort.hpp"
+#include "../record_index.hpp"
+#include "../record_profile.hpp"
+#include "../shared_counters.hpp"
+#include "../record_seek.hpp"
 #include "../crc32.hpp"
+#include "../hexdump.hpp"
 
 /**
  * Read hardware timestamped packets from a Exablaze Fusion
@@ -17,7 +37,7 @@
  * The output is either to a pcap (fixed) or to file/screen.
  */
 
-static int g_running = 1;
+static std::atomic<int> g_running(1);
 
 void signal_handler(int signal)
 {
@@ -39,60 +59,370 @@ static void usage(char* exe)
               << "Decode timestamped packet streams produced by the ExaLINK Fusion and\n"
               << "ExaLINK Fusion HPT.\n\n"
               << "Built "
-#ifdef WITH_EXANIC
-                 "with"
+#ifdef WITH_EXANIC_EMULATOR
+                 "with an emulated ExaNIC in place of"
+#elif defined(WITH_EXANIC)
+                 "with support for"
 #else
-                 "without"
+                 "without support for"
 #endif
-                 " support for direct ExaNIC capture\n\n"
+                 " direct ExaNIC capture\n\n"
               << options::usage_str()
               << std::endl;
 }
 
+// lock the pages mapped so far, and those mapped later too if the limit
+// allows, so that polling never waits on a page fault or swap
+static void lock_memory()
+{
+    rlimit limit;
+    const bool unlimited = getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY;
+    const int flags = unlimited || geteuid() == 0 ? MCL_CURRENT | MCL_FUTURE : MCL_CURRENT;
+    if (mlockall(flags) == -1)
+        std::cerr << "Low jitter: could not lock memory: " << strerror(errno)
+                  << " (see ulimit -l)" << std::endl;
+    else
+        std::cerr << "Low jitter: memory locked"
+                  << (flags & MCL_FUTURE ? "" : ", not including later allocations") << std::endl;
+}
+
+static void report_buffers()
+{
+    const page_buffer::usage_t usage = page_buffer::usage();
+    std::cerr << "Low jitter: " << usage.bytes / (1 << 20) << "MB of batches faulted in, "
+              << usage.reserved_huge_bytes / (1 << 20) << "MB on reserved huge pages, "
+              << usage.transparent_huge_bytes / (1 << 20) << "MB advised transparent huge pages"
+              << std::endl;
+}
+
 static void print_record(std::ostream& os, const char* buffer, size_t len,
                    const char* prefix = "    ")
 {
-    const char digits[] = "0123456789abcdef";
-    const char* p = buffer;
-    const char* end = p + len;
-    int block = 0;
-    while (p < end)
+    // blocks of 8 bytes, 4 blocks to a line
+    std::vector<char> hex(2 * len);
+    hex_encode(buffer, len, hex.data());
+    std::string text;
+    size_t block = 0;
+    for (size_t i = 0; i < len; i += 8)
     {
         if (block)
-            os << ' ';
+            text += ' ';
         else
-            os << prefix;
-        for (size_t j = 0; j < 8 && p < end; ++j, ++p)
+            text += prefix;
+        text.append(&hex[2 * i], 2 * std::min<size_t>(8, len - i));
+        if (++block == 4)
         {
-            const uint8_t c = *p;
-            os << digits[ (c >> 4) & 0xf ];
-            os << digits[ c & 0xf ];
-        }
-        ++block;
-        if (block == 4)
-        {
-            os << std::endl;
+            text += '\n';
             block = 0;
         }
     }
     if (len > 4)
     {
-        uint32_t fcs = crc32(0, buffer, len - 4);
+        const uint32_t fcs = crc32(0, buffer, len - 4);
+        const uint8_t bytes[4] = { uint8_t(fcs), uint8_t(fcs >> 8), uint8_t(fcs >> 16), uint8_t(fcs >> 24) };
+        char digits[8];
+        hex_encode(bytes, sizeof(bytes), digits);
         if (block)
-            os << "     fcs=";
+            text += "     fcs=";
         else
-            os << prefix << "    fcs=";
-        for (int i = 0; i < 32; i += 8)
-        {
-            os << digits[(fcs >> (i+4)) & 0xf];
-            os << digits[(fcs >> i) & 0xf];
-        }
-        os << std::endl;
+            text += std::string(prefix) + "    fcs=";
+        text.append(digits, sizeof(digits));
+        text += '\n';
     }
     else if (block)
-        os << std::endl;
+        text += '\n';
+    os << text << std::flush;
+}
+
+// decode from the current position until the timestamp format and offset
+// are known, then go back to it; false if they were not found in the
+// first max_records records or the reader cannot seek
+static bool probe_format(record_reader& reader, process_options& process, size_t buffer_len)
+{
+    const size_t max_records = 4096;
+    const int64_t start = reader.tell();
+    if (start < 0)
+        return false;
+
+    process_options quiet = process;
+    quiet.verbose = 0;
+    record_process probe(quiet);
+    std::vector<char> buffer(buffer_len);
+    for (size_t i = 0; i < max_records && !probe.detected(); ++i)
+    {
+        read_record_t record = reader.next(buffer.data(), buffer.size());
+        if (record.status != read_record_t::ok || probe.process(record, buffer.data(), buffer.size()).status < 0)
+            break;
+    }
+    reader.seek(start);
+    if (!probe.detected())
+        return false;
+    const int verbose = process.verbose;
+    process = probe.detected_options();
+    process.verbose = verbose;
+    return true;
+}
+
+// seek the reader to the --start time and read sparsely if times_only,
+// setting the options to decode it with; returns whether it reads sparsely
+static bool prepare_input(record_reader& reader, const options& opt, bool times_only,
+                          process_options& process, size_t buffer_len)
+{
+    process = opt.process;
+    if (opt.start)
+    {
+        // otherwise everything before the start is decoded and skipped
+        if (seek_time(reader, opt.start) && reader.index())
+            process = reader.index()->decode_options(opt.process);
+        if (opt.verbose)
+            std::cout << "Starting at offset " << reader.tell() << std::endl;
+    }
+
+    const bool sparse = times_only
+        && (record_process(process).detected() || probe_format(reader, process, buffer_len));
+    if (sparse)
+    {
+        process.fix_fcs = false;
+        reader.sparse(record_process::decode_head_len, record_process::decode_tail_len);
+    }
+    return sparse;
 }
 
+/**
+ * Writes decoded batches and accounts for their records in order,
+ * reporting problems to log numbered from the first record it sees.
+ */
+struct batch_sink
+{
+    batch_sink(const options& opt, record_writer& writer, std::ostream& log,
+               size_t first_record = 0)
+    : opt(opt)
+    , writer(writer)
+    , log(log)
+    , count_packet_in(first_record)
+    {}
+
+    batch_sink(const batch_sink&) = delete;
+    void operator=(const batch_sink&) = delete;
+
+    const options& opt;
+    record_writer& writer;
+    std::ostream& log;
+
+    size_t count_packet_in = 0;
+    size_t count_packet_out = 0;
+    size_t count_errors = 0;
+    size_t count_key_frames = 0;
+    size_t count_bytes_in = 0;
+    size_t count_bytes_out = 0;
+    // records that did not decode, by record_time_t::status_t
+    size_t count_status[shared_counters::statuses] = {};
+    int ret = 0;
+    // the counts are published here after each batch unless it is null,
+    // with the overflows of the readers feeding the sink
+    shared_counters* counters = nullptr;
+    std::vector<const record_reader*> readers = std::vector<const record_reader*>();
+    // the reader reached the end of its input
+    bool at_eof = false;
+
+    bool before_window(const record_time_t& timed) const
+    {
+        return opt.start && timed.status == record_time_t::ok && timed.hw_time < opt.start;
+    }
+
+    bool after_window(const record_time_t& timed) const
+    {
+        return opt.end && timed.status == record_time_t::ok && timed.hw_time > opt.end;
+    }
+
+    // returns false once no more records should be handled, messages are
+    // written after flushing the records before them
+    bool operator()(record_batch& batch)
+    {
+        const bool more = handle(batch);
+        if (counters)
+            publish();
+        return more;
+    }
+
+    void publish()
+    {
+        counters->begin();
+        counters->store(shared_counters::packets_in, count_packet_in);
+        counters->store(shared_counters::packets_out, count_packet_out);
+        counters->store(shared_counters::bytes_in, count_bytes_in);
+        counters->store(shared_counters::bytes_out, count_bytes_out);
+        counters->store(shared_counters::key_frames, count_key_frames);
+        counters->store(shared_counters::errors, count_errors);
+        uint64_t overflows = 0;
+        for (const record_reader* reader : readers)
+            overflows += reader->overflows();
+        counters->store(shared_counters::overflows, overflows);
+        for (size_t i = 0; i < shared_counters::statuses; ++i)
+            counters->store(shared_counters::status_errors + i, count_status[i]);
+        counters->end();
+    }
+
+    void count_status_error(int status)
+    {
+        if (status >= shared_counters::first_status && status <= shared_counters::last_status)
+            ++count_status[status - shared_counters::first_status];
+    }
+
+    bool handle(record_batch& batch)
+    {
+        // records before any unrecoverable processing error can be written
+        size_t writable = 0;
+        while (writable < batch.size && batch.records[writable].status == read_record_t::ok
+               && batch.times[writable].status >= 0)
+            ++writable;
+
+        // a record decoded after the --end time ends the output
+        size_t window_end = batch.size;
+        for (size_t i = 0; opt.end && i < writable; ++i)
+        {
+            if (after_window(batch.times[i]))
+            {
+                window_end = writable = i;
+                break;
+            }
+        }
+
+        // records decoded before the --start time are skipped, in the
+        // common case this is a single call to the writer
+        size_t written = 0;
+        for (size_t begin = 0; begin < writable; )
+        {
+            size_t end = begin;
+            while (end < writable && !before_window(batch.times[end]))
+                ++end;
+            if (end > begin)
+            {
+                const size_t limit = opt.count ? opt.count - count_packet_out - written : 0;
+                const size_t stopped = writer.write_batch(batch, begin, end, limit);
+                for (size_t i = begin; i < stopped; ++i)
+                {
+                    if (batch.times[i].status == record_time_t::ok && !batch.results[i])
+                        ++written;
+                }
+                if (stopped < end || (opt.count && count_packet_out + written == opt.count)
+                    || (batch.times[stopped - 1].status == record_time_t::ok && batch.results[stopped - 1] < 0))
+                    break;
+            }
+            while (end < writable && before_window(batch.times[end]))
+                batch.results[end++] = +1;
+            begin = end;
+        }
+
+        // stop where the writer did
+        for (size_t i = 0; i < batch.size; ++i)
+        {
+            const read_record_t& record = batch.records[i];
+            if (i == window_end)
+                return false;
+            if (record.status == read_record_t::eof)
+            {
+                at_eof = true;
+                return false;
+            }
+
+            ++count_packet_in;
+            if (record.status == read_record_t::ok)
+            {
+                count_bytes_in += record.len_capture;
+                const record_time_t& timed = batch.times[i];
+                if (timed.status != record_time_t::ok)
+                    count_status_error(timed.status);
+                if (timed.status < 0)
+                {
+                    writer.flush();
+                    log << "unrecoverable error processing record #"
+                              <<  count_packet_in << " ("
+                              << record.len_capture << " bytes): " << timed.status_str()
+                              << std::endl;
+                    if (opt.verbose)
+                        print_record(log, record.data, record.len_capture);
+                    ret = (int)return_value::process_error;
+                    ++count_errors;
+                    return false;
+                }
+                else if (timed.status > 0)
+                {
+                    if (opt.verbose > 1)
+                    {
+                        writer.flush();
+                        log << "recoverable problem processing record #"
+                                  <<  count_packet_in << " ("
+                                  << record.len_capture << " bytes): " << timed.status_str()
+                                  << std::endl;
+                        if (opt.verbose > 2)
+                            print_record(log, record.data, record.len_capture);
+                    }
+                    ++count_errors;
+                }
+                else
+                {
+                    assert(timed.status == record_time_t::ok);
+                    if (timed.is_keyframe)
+                        ++count_key_frames;
+                    const int err = batch.results[i];
+                    if (err < 0)
+                    {
+                        if (opt.verbose)
+                        {
+                            log << "unrecoverable write error (" << err << ")"
+                                << std::endl;
+                        }
+                        ++count_errors;
+                        return false;
+                    }
+                    else if (!err)
+                    {
+                        ++count_packet_out;
+                        count_bytes_out += record.len_capture;
+                        if (count_packet_out == opt.count)
+                            return false;
+                    }
+                    // else its a key frame that is intentionally skipped
+                }
+            }
+            else if (record.status == read_record_t::error)
+            {
+                writer.flush();
+                log << "problem reading record #" << count_packet_in << std::endl;
+                ret = (int)return_value::reader_error;
+                ++count_errors;
+                return false;
+            }
+            else
+            {
+                writer.flush();
+                log << "unknown record status" << std::endl;
+                ret = (int)return_value::fault;
+                ++count_errors;
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// a chunk decoded by a worker, with its output and messages held for commit
+struct decoded_chunk : chunk_result
+{
+    decoded_chunk(const options& opt, const record_writer& writer, size_t first_record)
+    : output()
+    , errors()
+    , fragment(writer.fragment(output))
+    , sink(opt, *fragment, errors, first_record)
+    {}
+
+    std::ostringstream output;
+    std::ostringstream errors;
+    std::unique_ptr<record_writer> fragment;
+    batch_sink sink;
+};
+
 int main(int argc, char** argv)
 {
     options opt;
@@ -113,6 +443,32 @@ int main(int argc, char** argv)
     signal(SIGALRM, signal_handler);
     signal(SIGTERM, signal_handler);
 
+    if (opt.build_index)
+    {
+        try
+        {
+            for (const std::string& source : opt.sources)
+            {
+                read_options read = opt.read;
+                read.source = source;
+                std::unique_ptr<record_index> index = record_index::build(read, opt.process);
+                index->save(source);
+                if (opt.verbose)
+                {
+                    std::cout << "Index: " << index->keyframes.size() << " keyframes, "
+                              << index->checkpoints.size() << " checkpoints written to "
+                              << record_index::path(source) << std::endl;
+                }
+            }
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Problem building index: " << e.what() << std::endl;
+            return (int)return_value::initialisation;
+        }
+        return (int)return_value::ok;
+    }
+
     std::unique_ptr<record_reader> reader = record_reader::make(opt.read);
     if (!reader)
         return (int)return_value::initialisation;
@@ -123,107 +479,267 @@ int main(int argc, char** argv)
 
     // pick a buffer len suitable for largest possible payload and various headers
     const size_t buffer_len = 0x10080;
-    char buffer[buffer_len]; 
-    record_process proc(opt.process);
+    // records handled per call to the reader, processor and writer
+    const size_t batch_len = 64;
+    // when only times and lengths are written, long records need only be
+    // read at each end; diagnostics at --verbose dump whole records
+    const bool times_only = writer->type() == "text" && !opt.write.write_packet && !opt.verbose;
+    process_options process;
+    const bool sparse = prepare_input(*reader, opt, times_only, process, buffer_len);
+    record_process proc(process);
 
-    size_t count_packet_in = 0;
-    size_t count_packet_out = 0;
-    size_t count_errors = 0;
-    size_t count_key_frames = 0;
-    while (g_running)
+    batch_sink write_batch(opt, *writer, std::cerr);
+    std::unique_ptr<shared_counters> counters;
+    if (!opt.counters_name.empty())
     {
-        read_record_t record = reader->next(buffer, buffer_len);
-        if (record.status == read_record_t::again)
-            continue;
-        else if (record.status == read_record_t::eof)
-            break;
+        try
+        {
+            counters = shared_counters::create(opt.counters_name);
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "Problem setting up counters: " << e.what() << std::endl;
+            return (int)return_value::initialisation;
+        }
+        write_batch.counters = counters.get();
+    }
+    write_batch.readers.push_back(reader.get());
 
-        ++count_packet_in;
-        if (record.status == read_record_t::ok)
+    // out of order records are sorted on the way to the writer
+    std::unique_ptr<record_sorter> sorter;
+    std::unique_ptr<record_external_sort> external_sort;
+    std::function<bool(record_batch&)> sink = std::ref(write_batch);
+    if (opt.write.sort_window_ns)
+    {
+        sorter.reset(new record_sorter(opt.write.sort_window_ns, batch_len, std::ref(write_batch)));
+        sink = std::ref(*sorter);
+    }
+    else if (opt.write.sort_memory)
+    {
+        const char* tmp_dir = getenv("TMPDIR");
+        try
+        {
+            external_sort.reset(new record_external_sort(opt.write.sort_memory, opt.threads.jobs,
+                                                         tmp_dir && *tmp_dir ? tmp_dir : "/tmp",
+                                                         batch_len, buffer_len, std::ref(write_batch),
+                                                         std::cerr));
+        }
+        catch (std::exception& e)
         {
-            record_time_t timed = proc.process(record, buffer);
-            if (timed.status < 0)
+            std::cerr << "Problem setting up sort: " << e.what() << std::endl;
+            return (int)return_value::initialisation;
+        }
+        sink = std::ref(*external_sort);
+    }
+    // output held while no records arrive is still written within the
+    // flush interval
+    auto idle = [&]()
+    {
+        writer->maybe_flush();
+    };
+
+    // records still held for sorting are written once the input ends
+    auto finish = [&]()
+    {
+        if (sorter)
+            sorter->flush();
+        if (external_sort)
+        {
+            external_sort->flush(g_running);
+            if (external_sort->failed())
+                write_batch.ret = (int)return_value::fault;
+        }
+        writer->flush();
+    };
+
+    if (opt.threads.low_jitter)
+        lock_memory();
+
+    std::unique_ptr<record_profile> profile;
+    if (opt.profile)
+        profile.reset(new record_profile(std::cerr, opt.profile_interval_s));
+
+    if (opt.sources.size() > 1)
+    {
+        // each input is read and decoded ahead on its own thread
+        record_merge merge(opt.threads, batch_len, buffer_len, profile.get());
+        merge.add_input(std::move(reader), process, opt.sources[0]);
+        for (size_t i = 1; i < opt.sources.size(); ++i)
+        {
+            read_options read = opt.read;
+            read.source = opt.sources[i];
+            std::unique_ptr<record_reader> input = record_reader::make(read);
+            if (!input)
+                return (int)return_value::initialisation;
+            process_options input_process;
+            prepare_input(*input, opt, times_only, input_process, buffer_len);
+            write_batch.readers.push_back(input.get());
+            merge.add_input(std::move(input), input_process, opt.sources[i]);
+        }
+        if (opt.threads.low_jitter)
+            report_buffers();
+        merge.run(sink, g_running, idle);
+        finish();
+        // the merge owns the readers
+        write_batch.readers.clear();
+        if (opt.verbose)
+            merge.print_stats(std::cout);
+    }
+    else if (opt.threads.jobs > 1 && reader->tell() >= 0 && !opt.count && !sorter && !external_sort)
+    {
+        // each worker reads its chunks through its own reader, decodes them
+        // with its own processor and writes them to memory
+        std::vector<std::unique_ptr<record_reader>> readers;
+        std::vector<std::unique_ptr<record_batch>> batches;
+        for (size_t i = 0; i < opt.threads.jobs; ++i)
+        {
+            readers.push_back(record_reader::make(opt.read));
+            if (!readers.back())
+                return (int)return_value::initialisation;
+            if (sparse)
+                readers.back()->sparse(record_process::decode_head_len, record_process::decode_tail_len);
+            batches.emplace_back(new record_batch(batch_len, buffer_len));
+        }
+
+        auto decode = [&](const parallel_chunk& chunk, size_t worker)
+        {
+            record_reader& chunk_reader = *readers[worker];
+            record_batch& batch = *batches[worker];
+            std::unique_ptr<decoded_chunk> result(new decoded_chunk(opt, *writer, chunk.first_record));
+
+            // a chunk that cannot start as the serial decode would have is
+            // failed, ending the output there, rather than decoded without
+            // the keyframe before it
+            auto fail = [&](const char* what, return_value ret)
             {
-                std::cerr << "unrecoverable error processing record #"
-                          <<  count_packet_in << " ("
-                          << record.len_capture << " bytes): " << timed.status_str()
-                          << std::endl;
-                if (opt.verbose)
-                    print_record(std::cerr, buffer, record.len_capture);
-                ret = (int)return_value::process_error;
-                ++count_errors;
-                break;
-            }
-            else if (timed.status > 0)
+                result->errors << "could not " << what << " for the records from #"
+                               << chunk.first_record + 1 << std::endl;
+                result->sink.ret = (int)ret;
+                ++result->sink.count_errors;
+                return std::unique_ptr<chunk_result>(std::move(result));
+            };
+
+            record_process chunk_proc(chunk.process);
+            if (chunk.keyframe >= 0)
             {
-                if (opt.verbose > 1)
-                {
-                    std::cerr << "recoverable problem processing record #"
-                              <<  count_packet_in << " ("
-                              << record.len_capture << " bytes): " << timed.status_str()
-                              << std::endl;
-                    if (opt.verbose > 2)
-                        print_record(std::cerr, buffer, record.len_capture);
-                }
-                ++count_errors;
-                continue;
+                if (!chunk_reader.seek(chunk.keyframe))
+                    return fail("seek to their keyframe", return_value::reader_error);
+                read_record_t keyframe = chunk_reader.next(batch.slot(0), batch.slot_len);
+                if (keyframe.status != read_record_t::ok)
+                    return fail("read their keyframe", return_value::reader_error);
+                const record_time_t seeded = chunk_proc.process(keyframe, batch.slot(0), batch.slot_len);
+                if (seeded.status != record_time_t::ok || !seeded.is_keyframe)
+                    return fail("decode their keyframe", return_value::process_error);
             }
-            else
+            if (!chunk_reader.seek(chunk.begin, chunk.end))
+                return fail("seek to the start", return_value::reader_error);
+            while (g_running)
             {
-                assert(timed.status == record_time_t::ok);
-                if (timed.is_keyframe)
-                    ++count_key_frames;
-                const int err = writer->write(timed, record, buffer);
-                if (err < 0)
-                {
-                    if (opt.verbose)
-                    {
-                        std::cerr << "unrecoverable write error (" << err << ")"
-                                  << std::endl;
-                    }
-                    ++count_errors;
+                stage_timer timer(profile.get());
+                const size_t count = chunk_reader.next_batch(batch);
+                timer.done(record_profile::read, batch, count);
+                if (!count)
+                    continue;
+                chunk_proc.process_batch(batch);
+                timer.done(record_profile::decode, batch, count);
+                const bool more = result->sink(batch);
+                timer.done(record_profile::write, batch, count);
+                if (!more)
                     break;
-                }
-                else if (!err)
-                {
-                    ++count_packet_out;
-                    if (count_packet_out == opt.count)
-                        break;
-                }
-                // else its a key frame that is intentionally skipped
             }
-        }
-        else if (record.status == read_record_t::error)
-        {
-            std::cerr << "problem reading record #" << count_packet_in << std::endl;
-            ret = (int)return_value::reader_error;
-            ++count_errors;
-            break;
-        }
-        else if (record.status == read_record_t::overflow)
+            result->fragment->flush();
+            return std::unique_ptr<chunk_result>(std::move(result));
+        };
+
+        auto commit = [&](chunk_result& result)
         {
-            std::cerr << "overflow when reading record  #" << count_packet_in << std::endl;
-            ret = (int)return_value::reader_error;
-            ++count_errors;
-            break;
-        }
-        else
+            const decoded_chunk& decoded = static_cast<decoded_chunk&>(result);
+            std::cerr << decoded.errors.str();
+            const bool written = !writer->append(decoded.output.str());
+
+            const batch_sink& counts = decoded.sink;
+            write_batch.count_packet_in = counts.count_packet_in;
+            write_batch.count_packet_out += counts.count_packet_out;
+            write_batch.count_errors += counts.count_errors;
+            write_batch.count_key_frames += counts.count_key_frames;
+            write_batch.count_bytes_in += counts.count_bytes_in;
+            write_batch.count_bytes_out += counts.count_bytes_out;
+            for (size_t i = 0; i < shared_counters::statuses; ++i)
+                write_batch.count_status[i] += counts.count_status[i];
+            if (write_batch.counters)
+                write_batch.publish();
+            if (counts.ret)
+                write_batch.ret = counts.ret;
+            // a chunk that stopped early ends the output as the serial
+            // decode would have
+            return written && counts.at_eof && g_running;
+        };
+
+        record_parallel parallel(opt.threads, process, buffer_len);
+        parallel.run(*reader, decode, commit);
+        writer->flush();
+        if (opt.verbose)
+            parallel.print_stats(std::cout);
+    }
+    else if (opt.threads.pipeline || reader->live())
+    {
+        // keep polling a live source while earlier records are decoded and written
+        record_pipeline pipeline(opt.threads, batch_len, buffer_len, profile.get());
+        if (opt.threads.low_jitter)
+            report_buffers();
+        pipeline.run(*reader, proc, sink, g_running, idle);
+        finish();
+        if (opt.verbose)
+            pipeline.print_stats(std::cout);
+    }
+    else
+    {
+        tune_polling_thread("capture", opt.threads.cpu_capture, opt.threads.fifo_priority,
+                            opt.threads.low_jitter || opt.threads.fifo_priority);
+
+        record_batch batch(batch_len, buffer_len, opt.threads.low_jitter);
+        if (opt.threads.low_jitter)
+            report_buffers();
+        while (g_running)
         {
-            std::cerr << "unknown record status" << std::endl;
-            ret = (int)return_value::fault;
-            ++count_errors;
-            break;
+            stage_timer timer(profile.get());
+            const size_t count = reader->next_batch(batch);
+            timer.done(record_profile::read, batch, count);
+            if (!count)
+            {
+                idle();
+                continue;
+            }
+            proc.process_batch(batch);
+            timer.done(record_profile::decode, batch, count);
+            const bool more = sink(batch);
+            timer.done(record_profile::write, batch, count);
+            if (!more)
+                break;
         }
+        finish();
     }
 
+    if (writer->close())
+    {
+        std::cerr << "Problem writing output: " << opt.write.dest << std::endl;
+        if (!write_batch.ret)
+            write_batch.ret = (int)return_value::fault;
+    }
+    if (profile)
+        profile->print(std::cerr);
     if (opt.verbose)
     {
-        std::cout << "Packets: read " << count_packet_in
-                  << ", key frames " << count_key_frames
-                  << ", written " << count_packet_out
-                  << ", errors " << count_errors
+        if (sorter)
+            sorter->print_stats(std::cout);
+        if (external_sort)
+            external_sort->print_stats(std::cout);
+        std::cout << "Packets: read " << write_batch.count_packet_in
+                  << ", key frames " << write_batch.count_key_frames
+                  << ", written " << write_batch.count_packet_out
+                  << ", errors " << write_batch.count_errors
                   << std::endl;
     }
-    return ret;
+    return write_batch.ret;
 }
 
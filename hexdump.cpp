@@ -0,0 +1,297 @@
+#include "hexdump.hpp"
+#include <string.h>
+#include <vector>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// separators of a full line after the offset, hex and gutter filled in later
+static const char line_template[] =
+    ":                                     "
+    "                  \n";
+static const size_t line_body_len = sizeof(line_template) - 1;
+
+static inline bool printable(uint8_t c)
+{
+    // isprint() in the C locale
+    return c >= 0x20 && c < 0x7f;
+}
+
+// four spaces and at least four hex digits of offset
+static inline char* put_offset(char* out, size_t offset)
+{
+    memset(out, ' ', 4);
+    out += 4;
+    unsigned shift = 12;
+    while (shift < 60 && (offset >> (shift + 4)))
+        shift += 4;
+    for (int s = shift; s >= 0; s -= 4)
+        *out++ = hex_digits[(offset >> s) & 0xf];
+    return out;
+}
+
+// the layout for any line, short last lines included
+static char* dump_line_scalar(const uint8_t* p, size_t offset, size_t n, char* out)
+{
+    out = put_offset(out, offset);
+    *out++ = ':';
+    for (size_t k = 0; k < 16; ++k)
+    {
+        if (k % 4 == 0)
+            *out++ = ' ';
+        if (k < n)
+        {
+            *out++ = hex_digits[p[k] >> 4];
+            *out++ = hex_digits[p[k] & 0xf];
+        }
+        else
+        {
+            *out++ = ' ';
+            *out++ = ' ';
+        }
+    }
+    *out++ = ' ';
+    for (size_t k = 0; k < 16; ++k)
+    {
+        if (k % 8 == 0)
+            *out++ = ' ';
+        if (k < n)
+            *out++ = printable(p[k]) ? p[k] : '.';
+    }
+    *out++ = '\n';
+    return out;
+}
+
+// lines for data at offset base of the record
+static char* dump_scalar(const uint8_t* p, size_t len, size_t base, char* out)
+{
+    for (size_t i = 0; i < len; i += 16)
+        out = dump_line_scalar(p + i, base + i, len - i < 16 ? len - i : 16, out);
+    return out;
+}
+
+static size_t hexdump_scalar(const void* data, size_t len, char* out)
+{
+    return dump_scalar(static_cast<const uint8_t*>(data), len, 0, out) - out;
+}
+
+static void hex_encode_scalar(const void* data, size_t len, char* out)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < len; ++i)
+    {
+        *out++ = hex_digits[p[i] >> 4];
+        *out++ = hex_digits[p[i] & 0xf];
+    }
+}
+
+#if defined(__x86_64__)
+/*
+ * Nibbles are turned into digits with a compare and add, '0' + n plus the
+ * gap to 'a' where n > 9, then interleaved high nibble first.
+ */
+__attribute__((target("sse2")))
+static inline __m128i nibble_digits_sse2(__m128i nibbles)
+{
+    const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                                          _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+// hex of bytes 0-7 into lo and 8-15 into hi
+__attribute__((target("sse2")))
+static inline void hex_sse2(__m128i v, __m128i& lo, __m128i& hi)
+{
+    const __m128i mask = _mm_set1_epi8(0xf);
+    const __m128i high = nibble_digits_sse2(_mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    const __m128i low = nibble_digits_sse2(_mm_and_si128(v, mask));
+    lo = _mm_unpacklo_epi8(high, low);
+    hi = _mm_unpackhi_epi8(high, low);
+}
+
+// printable bytes kept, others replaced by '.'
+__attribute__((target("sse2")))
+static inline __m128i gutter_sse2(__m128i v)
+{
+    // signed compares, so bytes from 0x80 fail the first one
+    const __m128i keep = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                                       _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+    return _mm_or_si128(_mm_and_si128(keep, v), _mm_andnot_si128(keep, _mm_set1_epi8('.')));
+}
+
+// the part of a full line after the offset
+__attribute__((target("sse2")))
+static inline char* dump_body_sse2(__m128i lo, __m128i hi, __m128i gutter, char* out)
+{
+    memcpy(out, line_template, line_body_len);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 2), lo);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 11), _mm_srli_si128(lo, 8));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 20), hi);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 29), _mm_srli_si128(hi, 8));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 39), gutter);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 48), _mm_srli_si128(gutter, 8));
+    return out + line_body_len;
+}
+
+__attribute__((target("sse2")))
+static char* dump_sse2(const uint8_t* p, size_t len, size_t base, char* out)
+{
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i lo, hi;
+        hex_sse2(v, lo, hi);
+        out = put_offset(out, base + i);
+        out = dump_body_sse2(lo, hi, gutter_sse2(v), out);
+    }
+    if (i < len)
+        out = dump_line_scalar(p + i, base + i, len - i, out);
+    return out;
+}
+
+static size_t hexdump_sse2(const void* data, size_t len, char* out)
+{
+    return dump_sse2(static_cast<const uint8_t*>(data), len, 0, out) - out;
+}
+
+__attribute__((target("sse2")))
+static void hex_encode_sse2(const void* data, size_t len, char* out)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i lo, hi;
+        hex_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), lo, hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16), hi);
+    }
+    hex_encode_scalar(p + i, len - i, out + 2 * i);
+}
+
+/*
+ * The same steps on two lines at a time, the in lane unpacks leave the hex
+ * of the first line in the low halves and of the second in the high halves.
+ */
+__attribute__((target("avx2")))
+static inline void hex_avx2(__m256i v, __m256i& lo, __m256i& hi)
+{
+    const __m256i mask = _mm256_set1_epi8(0xf);
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i gap = _mm256_set1_epi8('a' - '0' - 10);
+    const __m256i zero = _mm256_set1_epi8('0');
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+    __m256i low = _mm256_and_si256(v, mask);
+    high = _mm256_add_epi8(_mm256_add_epi8(high, zero), _mm256_and_si256(_mm256_cmpgt_epi8(high, nine), gap));
+    low = _mm256_add_epi8(_mm256_add_epi8(low, zero), _mm256_and_si256(_mm256_cmpgt_epi8(low, nine), gap));
+    lo = _mm256_unpacklo_epi8(high, low);
+    hi = _mm256_unpackhi_epi8(high, low);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i gutter_avx2(__m256i v)
+{
+    const __m256i keep = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1f)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8(0x7f), v));
+    return _mm256_blendv_epi8(_mm256_set1_epi8('.'), v, keep);
+}
+
+__attribute__((target("avx2")))
+static size_t hexdump_avx2(const void* data, size_t len, char* out)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    char* const start = out;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        __m256i lo, hi;
+        hex_avx2(v, lo, hi);
+        const __m256i gutter = gutter_avx2(v);
+        out = put_offset(out, i);
+        out = dump_body_sse2(_mm256_castsi256_si128(lo), _mm256_castsi256_si128(hi),
+                             _mm256_castsi256_si128(gutter), out);
+        out = put_offset(out, i + 16);
+        out = dump_body_sse2(_mm256_extracti128_si256(lo, 1), _mm256_extracti128_si256(hi, 1),
+                             _mm256_extracti128_si256(gutter, 1), out);
+    }
+    return dump_sse2(p + i, len - i, i, out) - start;
+}
+
+__attribute__((target("avx2")))
+static void hex_encode_avx2(const void* data, size_t len, char* out)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i lo, hi;
+        hex_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)), lo, hi);
+        // back in byte order across the lanes
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    hex_encode_sse2(p + i, len - i, out + 2 * i);
+}
+
+static bool have_avx2()
+{
+    unsigned a, b, c, d;
+    // the os must also save the ymm registers on a context switch, which it
+    // reports through xcr0, or the first avx2 instruction faults
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX))
+        return false;
+    uint32_t xcr0, xcr0_high;
+    __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+    if ((xcr0 & 6) != 6)
+        return false;
+    return __get_cpuid_max(0, nullptr) >= 7 && __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & bit_AVX2);
+}
+#endif
+
+static std::vector<hexdump_kernel> find_kernels()
+{
+    std::vector<hexdump_kernel> kernels;
+    kernels.push_back({"scalar", hexdump_scalar, hex_encode_scalar});
+#if defined(__x86_64__)
+    // sse2 is part of x86_64
+    kernels.push_back({"sse2", hexdump_sse2, hex_encode_sse2});
+    if (have_avx2())
+        kernels.push_back({"avx2", hexdump_avx2, hex_encode_avx2});
+#endif
+    return kernels;
+}
+
+static const std::vector<hexdump_kernel>& kernels()
+{
+    static const std::vector<hexdump_kernel> supported = find_kernels();
+    return supported;
+}
+
+const hexdump_kernel* hexdump_kernels(size_t& count)
+{
+    count = kernels().size();
+    return kernels().data();
+}
+
+const char* hexdump_kernel_name()
+{
+    return kernels().back().name;
+}
+
+size_t hexdump(const void* data, size_t len, char* out)
+{
+    static const hexdump_fn fastest = kernels().back().dump;
+    return fastest(data, len, out);
+}
+
+void hex_encode(const void* data, size_t len, char* out)
+{
+    static const hex_encode_fn fastest = kernels().back().encode;
+    fastest(data, len, out);
+}
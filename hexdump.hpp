@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// longest output of a hexdump() line, allowing for a 64 bit offset
+static const size_t hexdump_line_max = 80;
+
+// bytes of out needed by hexdump() for len bytes of input
+static inline size_t hexdump_len(size_t len)
+{
+    return (len + 15) / 16 * hexdump_line_max;
+}
+
+// dumps 16 bytes per line, padding the hex of a short last line, as
+// "    0010: 00112233 44556677 8899aabb ccddeeff  ........ ........\n"
+// into out, which must hold hexdump_len(len); returns the bytes written
+// dispatches to the fastest kernel supported by the cpu
+size_t hexdump(const void* data, size_t len, char* out);
+
+// two lowercase hex digits per byte into out, which must hold 2 * len
+void hex_encode(const void* data, size_t len, char* out);
+
+typedef size_t (*hexdump_fn)(const void* data, size_t len, char* out);
+typedef void (*hex_encode_fn)(const void* data, size_t len, char* out);
+
+struct hexdump_kernel
+{
+    const char* name;
+    hexdump_fn dump;
+    hex_encode_fn encode;
+};
+
+// kernels supported by this cpu, slowest first, for testing and benchmarking
+const hexdump_kernel* hexdump_kernels(size_t& count);
+
+// name of the kernel used by hexdump() and hex_encode()
+const char* hexdump_kernel_name();
@@ -1,7 +1,79 @@
 #include "options.hpp"
 #include <sstream>
 #include <iostream>
+#include <cstdlib>
 #include <getopt.h>
+#include <string.h>
+#include <time.h>
+
+int options::parse_cpus(const std::string& arg)
+{
+    int* cpus[] = { &threads.cpu_capture, &threads.cpu_decode, &threads.cpu_write };
+    std::istringstream is(arg);
+    std::string item;
+    for (int i = 0; std::getline(is, item, ','); ++i)
+    {
+        char* end = nullptr;
+        long cpu = std::strtol(item.c_str(), &end, 10);
+        if (i == 3 || item.empty() || *end || cpu < 0)
+            return -1;
+        *cpus[i] = cpu;
+    }
+    return 0;
+}
+
+int options::parse_input_cpus(const std::string& arg)
+{
+    std::istringstream is(arg);
+    std::string item;
+    while (std::getline(is, item, ','))
+    {
+        char* end = nullptr;
+        long cpu = std::strtol(item.c_str(), &end, 10);
+        if (item.empty() || *end || cpu < -1)
+            return -1;
+        threads.cpu_inputs.push_back(cpu);
+    }
+    return threads.cpu_inputs.empty() ? -1 : 0;
+}
+
+int options::parse_time(const std::string& arg, pstime_t& time) const
+{
+    // the output date format with optional fractional seconds, or else
+    // seconds since the epoch
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_isdst = -1;
+    const char* frac = strptime(arg.c_str(), write.text_date_format.c_str(), &tm);
+    if (frac)
+        time = pstime_t(mktime(&tm), 0);
+    else
+    {
+        char* end = nullptr;
+        time = pstime_t(std::strtoll(arg.c_str(), &end, 10), 0);
+        if (end == arg.c_str())
+            return -1;
+        frac = end;
+    }
+
+    if (*frac == '.')
+    {
+        unsigned digits = 0;
+        uint64_t psec = 0;
+        for (++frac; *frac >= '0' && *frac <= '9'; ++frac)
+        {
+            if (digits++ < 12)
+                psec = psec * 10 + (*frac - '0');
+        }
+        if (!digits)
+            return -1;
+        time.precision = digits < 12 ? digits : 12;
+        for (unsigned i = time.precision; i < 12; ++i)
+            psec *= 10;
+        time.psec = psec;
+    }
+    return *frac ? -1 : 0;
+}
 
 int options::parse(int argc, char** argv)
 {
@@ -13,17 +85,41 @@ int options::parse(int argc, char** argv)
         {"read",         required_argument, 0, 'r'},
         {"write",        required_argument, 0, 'w'},
         {"date-format",  required_argument, 0, 'd'},
+        {"flush",        required_argument, 0, 'F'},
+        {"direct",       no_argument,       0, 'D'},
+        {"sort-window",  required_argument, 0, 'W'},
+        {"sort-memory",  required_argument, 0, 'M'},
         {"count",        required_argument, 0, 'c'},
         {"offset",       required_argument, 0, 'o'},
         {"32-bit",       no_argument,       0, '3'},
         {"trailer",      no_argument,       0, 't'},
         {"no-fix-fcs",   no_argument,       0, 'f'},
         {"no-promisc",   no_argument,       0, 'p'},
+        {"fanout",       required_argument, 0, 'G'},
+#ifdef WITH_EXANIC_EMULATOR
+        {"emulate",      required_argument, 0, 'X'},
+        {"emulate-rate", required_argument, 0, 'R'},
+        {"emulate-repeat", required_argument, 0, 'Y'},
+#endif
         {"no-payload",   no_argument,       0, 'n'},
         {"capture-time", no_argument,       0, 'C'},
+        {"pipeline",     no_argument,       0, 'P'},
+        {"cpus",         required_argument, 0, 'U'},
+        {"input-cpus",   required_argument, 0, 'K'},
+        {"fifo",         required_argument, 0, 'Q'},
+        {"low-jitter",   no_argument,       0, 'L'},
+        {"jobs",         required_argument, 0, 'j'},
+        {"build-index",  no_argument,       0, 'I'},
+        {"profile",      required_argument, 0, 'O'},
+        {"counters",     required_argument, 0, 'Z'},
+        {"start",        required_argument, 0, 'S'},
+        {"end",          required_argument, 0, 'E'},
         {0, 0,                              0, 0}
     };
 
+    std::string start_arg;
+    std::string end_arg;
+
     // show usage if there are no arguments
     if (argc == 1)
         return 1;
@@ -43,7 +139,9 @@ int options::parse(int argc, char** argv)
             write.verbose = verbose;
             break;
         case 'r':
-            read.source = optarg;
+            sources.push_back(optarg);
+            if (sources.size() == 1)
+                read.source = optarg;
             break;
         case 'w':
             write.dest = optarg;
@@ -51,6 +149,18 @@ int options::parse(int argc, char** argv)
         case 'd':
             write.text_date_format = optarg;
             break;
+        case 'F':
+            write.flush_interval_ms = std::atoi(optarg);
+            break;
+        case 'D':
+            write.direct_io = true;
+            break;
+        case 'W':
+            write.sort_window_ns = std::strtoull(optarg, nullptr, 10);
+            break;
+        case 'M':
+            write.sort_memory = size_t(std::strtoull(optarg, nullptr, 10)) << 20;
+            break;
         case 'c':
             count = std::atoi(optarg);
             break;
@@ -72,12 +182,81 @@ int options::parse(int argc, char** argv)
         case 'p':
             read.promiscuous_mode = false;
             break;
+        case 'G':
+            read.fanout = std::atoi(optarg) & 0xffff;
+            break;
+        case 'X':
+            read.emulate = optarg;
+            break;
+        case 'R':
+            read.emulate_gbps = std::atof(optarg);
+            break;
+        case 'Y':
+            read.emulate_repeat = std::atoi(optarg);
+            break;
         case 'n':
             write.write_packet = false;
             break;
         case 'C':
             write.write_clock_times = true;
             break;
+        case 'I':
+            build_index = true;
+            break;
+        case 'S':
+            start_arg = optarg;
+            break;
+        case 'E':
+            end_arg = optarg;
+            break;
+        case 'P':
+            threads.pipeline = true;
+            break;
+        case 'U':
+            if (parse_cpus(optarg))
+            {
+                std::cerr << argv[0] << ": cpus must be given as <capture>[,<decode>,<write>]" << std::endl;
+                return -1;
+            }
+            break;
+        case 'K':
+            if (parse_input_cpus(optarg))
+            {
+                std::cerr << argv[0] << ": input cpus must be given as <cpu>[,<cpu>...]" << std::endl;
+                return -1;
+            }
+            break;
+        case 'Q':
+            threads.fifo_priority = std::atoi(optarg);
+            if (threads.fifo_priority < 1 || threads.fifo_priority > 99)
+            {
+                std::cerr << argv[0] << ": fifo priority must be from 1 to 99" << std::endl;
+                return -1;
+            }
+            break;
+        case 'L':
+            threads.low_jitter = true;
+            break;
+        case 'j':
+            if (std::atoi(optarg) < 1)
+            {
+                std::cerr << argv[0] << ": jobs must be at least 1" << std::endl;
+                return -1;
+            }
+            threads.jobs = std::atoi(optarg);
+            break;
+        case 'O':
+            if (std::atoi(optarg) < 0)
+            {
+                std::cerr << argv[0] << ": profile interval must not be negative" << std::endl;
+                return -1;
+            }
+            profile = true;
+            profile_interval_s = std::atoi(optarg);
+            break;
+        case 'Z':
+            counters_name = optarg;
+            break;
         case '?':
         case 'h':
             return 1;
@@ -95,6 +274,24 @@ int options::parse(int argc, char** argv)
         std::cerr << argv[0] << ": input must be provided using the --read option" << std::endl;
         return -1;
     }
+    // times are parsed once the date format is known
+    if ((!start_arg.empty() && parse_time(start_arg, start))
+        || (!end_arg.empty() && parse_time(end_arg, end)))
+    {
+        std::cerr << argv[0] << ": times must be given in the date format, "
+                  << "or as seconds since the epoch" << std::endl;
+        return -1;
+    }
+    if (write.sort_window_ns && write.sort_memory)
+    {
+        std::cerr << argv[0] << ": only one of --sort-window and --sort-memory may be given" << std::endl;
+        return -1;
+    }
+    if (start && end && end < start)
+    {
+        std::cerr << argv[0] << ": end must not be before start" << std::endl;
+        return -1;
+    }
     switch (process.timestamp_format)
     {
     case process_options::timestamp_format_trailer:
@@ -129,13 +326,41 @@ std::string options::usage_str()
 {
     std::ostringstream os;
     os << "Input options:\n"
-       << "  --read <file>     pcap file input, or ExaNIC interface name\n"
+       << "  --read <file>     pcap file input, which may be .gz or .zst compressed,\n"
+       << "                    - for stdin, or an ExaNIC or other interface name;\n"
+       << "                    given more than once, the inputs are merged by\n"
+       << "                    hardware time\n"
        << "  --count <n>       number of records to read, 0 for all\n"
        << "  --no-promisc, -p  do not attempt to put interface in promiscuous mode\n"
+       << "  --fanout <id>     share the packets of a non ExaNIC interface by flow\n"
+       << "                    with other captures in AF_PACKET fanout group id\n"
+#ifdef WITH_EXANIC_EMULATOR
+       << "  --emulate <file>  capture replayed into the emulated ExaNIC read as\n"
+       << "                    <device>:<port>\n"
+       << "  --emulate-rate <Gbps>\n"
+       << "                    replay back to back at this line rate rather than\n"
+       << "                    at the capture's own timing\n"
+       << "  --emulate-repeat <n>\n"
+       << "                    times to replay the capture (1)\n"
+#endif
+       << "  --start <time>    skip to the first record at or after this hardware\n"
+       << "                    time, in the date format or seconds since epoch\n"
+       << "  --end <time>      stop at the first record after this hardware time\n"
+       << "  --build-index     index keyframes and times of the pcap file to\n"
+       << "                    <file>.tsidx and exit\n"
        << "\n"
        << "Output options:\n"
        << "  --write <file>    file for output, - for stdout, or ending in .pcap\n"
        << "  --date-format <s> date-time format to use for output\n"
+       << "  --flush <ms>      longest to hold text output before writing it (100)\n"
+       << "  --direct          write pcap output with O_DIRECT, bypassing the page\n"
+       << "                    cache where the file system supports it\n"
+       << "  --sort-window <ns>\n"
+       << "                    write records in hardware time order, holding them\n"
+       << "                    until this far behind the latest time seen\n"
+       << "  --sort-memory <MB>\n"
+       << "                    write the whole input in hardware time order, using\n"
+       << "                    this much memory and temporary files in $TMPDIR\n"
        << "  --all             write all packets, including keyframes\n"
        << "  --capture-time    write capture time to stdout\n"
        << "  --no-payload      don't write packet contents to stdout\n"
@@ -146,7 +371,28 @@ std::string options::usage_str()
        << "  --offset <n>      timestamp offset from the end of packet\n"
        << "  --no-fix-fcs      don't rewrite 32 bit timestamp with correct FCS\n"
        << "\n"
+       << "Threading options:\n"
+       << "  --pipeline        capture, decode and write on separate threads\n"
+       << "                    (always used for live capture)\n"
+       << "  --cpus <a[,b,c]>  cpus for the capture, decode and write threads\n"
+       << "  --input-cpus <a[,b...]>\n"
+       << "                    cpus for the thread reading and decoding each\n"
+       << "                    --read input in turn when merging, -1 for any\n"
+       << "  --fifo <prio>     run the threads polling the inputs at this\n"
+       << "                    SCHED_FIFO priority, best on isolated cpus\n"
+       << "  --low-jitter      lock memory and fault in batches up front from\n"
+       << "                    huge pages where available, and keep threads\n"
+       << "                    spinning while idle instead of backing off\n"
+       << "  --jobs <n>        decode a pcap file on n threads (not used with\n"
+       << "                    --count or sorting), or spill --sort-memory runs\n"
+       << "                    on n threads\n"
+       << "\n"
        << "Other options:\n"
+       << "  --profile <s>     time reading, decoding and writing and show the\n"
+       << "                    cost per record of each at exit, and every s\n"
+       << "                    seconds unless 0\n"
+       << "  --counters <name> publish live counts in /dev/shm/<name> for\n"
+       << "                    timestamp-decoder-stats to show\n"
        << "  --verbose,    -v  specify more often to be more verbose\n"
        << "  --help,       -h  show this help and exit";
     return os.str();
@@ -1,12 +1,23 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "pstime.hpp"
 
 struct read_options
 {
     int verbose = 0;
     std::string source = "";
     bool promiscuous_mode = true;
+    // AF_PACKET fanout group to share an interface's packets in, -1 for none
+    int fanout = -1;
+    // capture replayed into the emulated ExaNIC, in emulator builds
+    std::string emulate = "";
+    // line rate of the replay in Gbps, zero for the capture's own timing
+    double emulate_gbps = 0;
+    unsigned emulate_repeat = 1;
 };
 
 struct process_options
@@ -33,6 +44,39 @@ struct write_options
     bool write_clock_times = false;
     bool write_packet = true;
     std::string text_date_format = "%Y/%m/%d-%H:%M:%S";
+    // longest text output is held before being written
+    unsigned flush_interval_ms = 100;
+    // pcap output is written from a background thread in blocks this long
+    size_t pcap_buffer_len = 8 << 20;
+    // write pcap output with O_DIRECT, bypassing the page cache
+    bool direct_io = false;
+    // records up to this far out of hardware time order are sorted before
+    // being written, zero to write them as read
+    uint64_t sort_window_ns = 0;
+    // sort the whole input in this much memory, spilling to temporary
+    // files, zero to not sort it
+    size_t sort_memory = 0;
+};
+
+struct thread_options
+{
+    // decode on separate capture, decode and write threads
+    bool pipeline = false;
+    // batches cycling through the pipeline
+    size_t batches = 64;
+    // cpus to pin each thread to, -1 to leave unpinned
+    int cpu_capture = -1;
+    int cpu_decode = -1;
+    int cpu_write = -1;
+    // cpus to pin the thread reading each merged input to, in --read order
+    std::vector<int> cpu_inputs = std::vector<int>();
+    // worker threads decoding a seekable capture in chunks, 1 to decode serially
+    unsigned jobs = 1;
+    // SCHED_FIFO priority for the threads polling the inputs, 0 to leave
+    // them to the normal scheduler
+    int fifo_priority = 0;
+    // lock memory and fault batches in up front from huge pages
+    bool low_jitter = false;
 };
 
 struct options
@@ -41,9 +85,26 @@ struct options
     read_options read = read_options();
     process_options process = process_options();
     write_options write = write_options();
+    thread_options threads = thread_options();
+    // every --read given, read.source is the first; several are merged
+    // by hardware time
+    std::vector<std::string> sources = std::vector<std::string>();
     uint32_t count = 0;
+    bool build_index = false;
+    // time each stage and report the costs at exit, and every interval
+    // seconds if it is not zero
+    bool profile = false;
+    unsigned profile_interval_s = 0;
+    // publish live counters in /dev/shm under this name, empty for none
+    std::string counters_name = "";
+    // hardware time window of records to write, zero for unbounded
+    pstime_t start = pstime_t(0, 0);
+    pstime_t end = pstime_t(0, 0);
 
     int parse(int argc, char** argv);
+    int parse_cpus(const std::string& arg);
+    int parse_input_cpus(const std::string& arg);
+    int parse_time(const std::string& arg, pstime_t& time) const;
 
     static std::string usage_str();
 };
@@ -0,0 +1,61 @@
+#include "page_buffer.hpp"
+#include <new>
+#include <sys/mman.h>
+
+std::atomic<size_t> page_buffer::bytes_(0);
+std::atomic<size_t> page_buffer::reserved_huge_bytes_(0);
+std::atomic<size_t> page_buffer::transparent_huge_bytes_(0);
+
+page_buffer::page_buffer(size_t len, bool huge_pages, bool populate)
+: data_(nullptr)
+, len_(len)
+, mapped_len_(0)
+{
+    if (!len)
+        return;
+
+    const int flags = MAP_PRIVATE | MAP_ANONYMOUS | (populate ? MAP_POPULATE : 0);
+    void* p = MAP_FAILED;
+    if (huge_pages)
+    {
+        mapped_len_ = (len + huge_page_len - 1) / huge_page_len * huge_page_len;
+        p = mmap(nullptr, mapped_len_, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            reserved_huge_bytes_ += mapped_len_;
+    }
+    if (p == MAP_FAILED)
+    {
+        mapped_len_ = len;
+        p = mmap(nullptr, mapped_len_, PROT_READ | PROT_WRITE,
+                 huge_pages ? flags & ~MAP_POPULATE : flags, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::bad_alloc();
+        // the advice has to come before the pages are faulted in, so they
+        // are touched here rather than populated by the mapping
+        if (huge_pages && madvise(p, mapped_len_, MADV_HUGEPAGE) == 0)
+            transparent_huge_bytes_ += mapped_len_;
+        if (huge_pages && populate)
+        {
+            volatile char* page = static_cast<char*>(p);
+            for (size_t i = 0; i < mapped_len_; i += 4096)
+                page[i] = 0;
+        }
+    }
+    bytes_ += mapped_len_;
+    data_ = static_cast<char*>(p);
+}
+
+page_buffer::~page_buffer()
+{
+    if (data_)
+        munmap(data_, mapped_len_);
+}
+
+page_buffer::usage_t page_buffer::usage()
+{
+    usage_t usage;
+    usage.bytes = bytes_;
+    usage.reserved_huge_bytes = reserved_huge_bytes_;
+    usage.transparent_huge_bytes = transparent_huge_bytes_;
+    return usage;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+/*
+ * Anonymous memory mapping for the large buffers records are read into.
+ * Pages are only faulted in once touched, unless the buffer is populated,
+ * when it is faulted in up front so that capture never waits on a page
+ * fault. Huge page buffers are taken from the reserved 2MB page pool when
+ * it has room, otherwise they ask for transparent huge pages.
+ */
+struct page_buffer
+{
+    // bytes mapped by all page buffers so far, and how
+    struct usage_t
+    {
+        size_t bytes;
+        size_t reserved_huge_bytes;
+        size_t transparent_huge_bytes;
+    };
+
+    // will throw std::bad_alloc if the memory cannot be mapped
+    explicit page_buffer(size_t len, bool huge_pages = false, bool populate = false);
+    ~page_buffer();
+
+    page_buffer(const page_buffer&) = delete;
+    void operator=(const page_buffer&) = delete;
+
+    char* data() const { return data_; }
+    size_t size() const { return len_; }
+    char& operator[](size_t i) const { return data_[i]; }
+
+    static usage_t usage();
+
+private:
+    static const size_t huge_page_len = 2 << 20;
+
+    static std::atomic<size_t> bytes_;
+    static std::atomic<size_t> reserved_huge_bytes_;
+    static std::atomic<size_t> transparent_huge_bytes_;
+
+    char* data_;
+    size_t len_;
+    // length mapped, rounded up to whole huge pages when they are used
+    size_t mapped_len_;
+};
@@ -1,43 +1,115 @@
 #pragma once
 
+#include <stdint.h>
+#include <time.h>
+
 struct pstime_t
 {
+    static constexpr uint64_t psec_per_sec = 1000000000000ULL;
+
     time_t sec;
     uint64_t psec;
     unsigned precision;
 
-    pstime_t(time_t s, uint64_t ps, unsigned prec = 12)
+    constexpr pstime_t(time_t s, uint64_t ps, unsigned prec = 12)
     : sec(s)
     , psec(ps)
     , precision(prec)
     {}
 
-    operator bool() const { return sec || psec; }
+    constexpr operator bool() const { return sec || psec; }
     explicit operator double() const { return sec + (psec / 1e12); }
 
-    pstime_t operator-(const pstime_t& rhs) const
+    constexpr pstime_t operator-(const pstime_t& rhs) const
+    {
+        return psec < rhs.psec
+            ? pstime_t(sec - rhs.sec - 1, psec_per_sec + psec - rhs.psec, min_precision(rhs))
+            : pstime_t(sec - rhs.sec, psec - rhs.psec, min_precision(rhs));
+    }
+
+    constexpr pstime_t operator+(const pstime_t& rhs) const
     {
-        unsigned p = precision < rhs.precision ? precision : rhs.precision;
-        if (psec < rhs.psec)
-            return pstime_t(sec - rhs.sec - 1, 1000000000000ULL + psec - rhs.psec, p);
-        else
-            return pstime_t(sec - rhs.sec, psec - rhs.psec, p);
+        return psec + rhs.psec >= psec_per_sec
+            ? pstime_t(sec + rhs.sec + 1, psec + rhs.psec - psec_per_sec, min_precision(rhs))
+            : pstime_t(sec + rhs.sec, psec + rhs.psec, min_precision(rhs));
     }
 
-    bool operator<(const pstime_t& rhs) const
+    constexpr bool operator<(const pstime_t& rhs) const
     {
         return sec < rhs.sec || (sec == rhs.sec && psec < rhs.psec);
     }
 
-    bool operator>(const pstime_t& rhs) const
+    constexpr bool operator>(const pstime_t& rhs) const
     {
         return sec > rhs.sec || (sec == rhs.sec && psec > rhs.psec);
     }
 
-    int64_t ns() const { return (sec * 1000000000LL) + (psec / 1000); }
+    // a difference is negative when sec is, psec always counts forward
+    constexpr bool negative() const { return sec < 0; }
+
+    // magnitude of a possibly negative difference
+    constexpr pstime_t abs() const
+    {
+        return !negative() ? *this
+            : psec ? pstime_t(-sec - 1, psec_per_sec - psec, precision)
+            : pstime_t(-sec, 0, precision);
+    }
+
+    constexpr int64_t ns() const { return (sec * 1000000000LL) + (psec / 1000); }
+
+private:
+    constexpr unsigned min_precision(const pstime_t& rhs) const
+    {
+        return precision < rhs.precision ? precision : rhs.precision;
+    }
 };
 
-static inline pstime_t ns_to_pstime(uint64_t ns)
+static constexpr pstime_t ns_to_pstime(uint64_t ns)
 {
     return pstime_t(ns / 1000000000, (ns % 1000000000) * 1000, 9);
 }
+
+// picoseconds in a binary fraction of a second with 40 fraction bits,
+// truncated like the fraction itself
+static constexpr uint64_t frac40_to_psec(uint64_t frac)
+{
+    return uint64_t((unsigned __int128)frac * pstime_t::psec_per_sec >> 40);
+}
+
+/*
+ * Converts counter ticks at a fixed frequency to nanoseconds without a
+ * division, using a reciprocal computed once per frequency. The result is
+ * exactly ticks * 1e9 / freq rounded down, for ticks below 2^32.
+ */
+struct tick_converter
+{
+    // reciprocal of freq scaled by 2^(64 + shift), less 2^64
+    uint64_t mult;
+    unsigned shift;
+    uint64_t freq;
+
+    explicit tick_converter(uint64_t f = 350000000)
+    : mult(0)
+    , shift(0)
+    , freq(f)
+    {
+        if (!freq)
+            return;
+        shift = 63 - __builtin_clzll(freq);
+        // a power of two is a plain shift, with mult 0
+        if (freq & (freq - 1))
+        {
+            ++shift;
+            const unsigned __int128 one = (unsigned __int128)1 << (64 + shift);
+            mult = uint64_t((one + freq - 1) / freq - ((unsigned __int128)1 << 64));
+        }
+    }
+
+    // the reciprocal is between 2^64 and 2^65, so its top bit is added
+    // separately; scaled is below 2^62 so the sum cannot overflow
+    uint64_t ns(uint64_t ticks) const
+    {
+        const uint64_t scaled = ticks * 1000000000;
+        return freq ? (uint64_t((unsigned __int128)scaled * mult >> 64) + scaled) >> shift : 0;
+    }
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include "page_buffer.hpp"
+#include "record_reader.hpp"
+#include "record_process.hpp"
+
+/*
+ * Arena of records for the batch interfaces, kept as parallel arrays so each
+ * stage only touches its own data: read results, decode results, write
+ * results and a fixed size payload slot per record.
+ * Zero copy readers leave the slots untouched, the slot is then only used
+ * when processing has to modify the record. For low jitter capture the
+ * slots are on huge pages and faulted in up front.
+ */
+struct record_batch
+{
+    const size_t capacity;
+    const size_t slot_len;
+    size_t size;
+    std::vector<read_record_t> records;
+    std::vector<record_time_t> times;
+    std::vector<int> results;
+    page_buffer payload;
+
+    record_batch(size_t n, size_t len, bool low_jitter = false)
+    : capacity(n)
+    , slot_len(len)
+    , size(0)
+    , records(n)
+    , times(n)
+    , results(n)
+    , payload(n * len, low_jitter, low_jitter)
+    {}
+
+    char* slot(size_t i) { return &payload[i * slot_len]; }
+};
+
+/*
+ * Batch loops for readers and writers to instantiate with their own final
+ * type, so that the per record calls are resolved statically.
+ */
+
+// stops after the first record that is not ok, a record with status again
+// is dropped so an empty batch means there was nothing to read
+template <typename Reader>
+size_t next_batch_loop(Reader& reader, record_batch& batch)
+{
+    batch.size = 0;
+    while (batch.size < batch.capacity)
+    {
+        read_record_t& record = batch.records[batch.size];
+        record = reader.next(batch.slot(batch.size), batch.slot_len);
+        if (record.status == read_record_t::again)
+            break;
+        ++batch.size;
+        if (record.status != read_record_t::ok)
+            break;
+    }
+    return batch.size;
+}
+
+template <typename Writer>
+size_t write_batch_loop(Writer& writer, record_batch& batch, size_t begin, size_t end, size_t limit)
+{
+    size_t written = 0;
+    for (size_t i = begin; i < end; ++i)
+    {
+        if (batch.times[i].status != record_time_t::ok)
+            continue;
+        const int err = writer.write(batch.times[i], batch.records[i], batch.records[i].data);
+        batch.results[i] = err;
+        if (err < 0 || (!err && ++written == limit))
+            return i + 1;
+    }
+    return end;
+}
@@ -0,0 +1,449 @@
+#include "record_external_sort.hpp"
+#include <algorithm>
+#include <stdexcept>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// sort order, earliest time first then earliest arrival
+static bool earlier(const pstime_t& a_key, uint64_t a_seq, const pstime_t& b_key, uint64_t b_seq)
+{
+    return a_key < b_key || (!(b_key < a_key) && a_seq < b_seq);
+}
+
+static bool pwrite_all(int fd, const char* data, size_t len, uint64_t offset)
+{
+    while (len)
+    {
+        const ssize_t n = pwrite(fd, data, len, offset);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/*
+ * Reads the records of one run back through a buffer, the record returned
+ * by next() stays valid until the following call.
+ */
+struct record_external_sort::run_cursor
+{
+    int fd;
+    uint64_t pos;
+    uint64_t end;
+    const size_t len;
+    std::unique_ptr<char[]> buffer;
+    // unread records are from begin to fill
+    size_t begin;
+    size_t fill;
+
+    run_cursor(int f, const run& r, size_t read_len)
+    : fd(f)
+    , pos(r.begin)
+    , end(r.end)
+    , len(read_len)
+    , buffer(new char[read_len])
+    , begin(0)
+    , fill(0)
+    {}
+
+    // 1 with the next record, 0 at the end of the run, -1 on a read error
+    int next(const spilled_record*& held, const char*& payload)
+    {
+        if (begin == fill && pos == end)
+            return 0;
+        if (!ensure(sizeof(spilled_record)))
+            return -1;
+        held = reinterpret_cast<const spilled_record*>(&buffer[begin]);
+        if (!ensure(spilled_len(held->record)))
+            return -1;
+        held = reinterpret_cast<const spilled_record*>(&buffer[begin]);
+        payload = &buffer[begin + sizeof(spilled_record)];
+        begin += spilled_len(held->record);
+        return 1;
+    }
+
+    // at least n unread bytes in the buffer, moving them to its start
+    bool ensure(size_t n)
+    {
+        if (fill - begin >= n)
+            return true;
+        memmove(&buffer[0], &buffer[begin], fill - begin);
+        fill -= begin;
+        begin = 0;
+        while (fill < n && pos < end)
+        {
+            const ssize_t got = pread(fd, &buffer[fill], std::min<uint64_t>(len - fill, end - pos), pos);
+            if (got == -1 && errno == EINTR)
+                continue;
+            if (got <= 0)
+            {
+                if (!got)
+                    errno = EIO;
+                return false;
+            }
+            fill += got;
+            pos += got;
+        }
+        if (fill < n)
+            errno = EIO;
+        return fill >= n;
+    }
+};
+
+record_external_sort::run_buffer::run_buffer(size_t arena_len)
+: arena(new char[arena_len])
+, staging()
+, len(arena_len)
+, used(0)
+, entries(0)
+, error(0)
+, thread()
+{}
+
+size_t record_external_sort::spilled_len(const read_record_t& record)
+{
+    return sizeof(spilled_record) + ((record.len_capture + 7) & ~size_t(7));
+}
+
+record_external_sort::record_external_sort(size_t memory_len, unsigned jobs, const std::string& tmp_dir,
+                                           size_t batch_len, size_t slot_len, const sink_t& sink,
+                                           std::ostream& log)
+: memory_len_(memory_len)
+, sink_(sink)
+, log_(log)
+, fd_(-1)
+, buffers_()
+, current_(0)
+, runs_()
+, spill_len_(0)
+, out_(batch_len, slot_len)
+, end_()
+, end_payload_()
+, ended_(false)
+, stopped_(false)
+, failed_(false)
+, seq_(0)
+, latest_(0, 0)
+, spilled_runs_(0)
+, merge_passes_(0)
+{
+    // one buffer is filled while the others are spilled, each spilling
+    // buffer stages its writes
+    const size_t workers = std::max<size_t>(1, std::min<size_t>(jobs, memory_len / (4 << 20)));
+    const size_t overhead = (workers + 1) * staging_len;
+    const size_t arena_len = memory_len > overhead ? (memory_len - overhead) / (workers + 1) & ~size_t(63) : 0;
+    const size_t longest = sizeof(spilled_record) + slot_len + 8 + sizeof(run_entry);
+    if (arena_len < 2 * longest || staging_len < longest || min_read_len < longest)
+        throw std::invalid_argument("sort memory is too small");
+
+    std::string path = tmp_dir + "/timestamp-decoder-sort-XXXXXX";
+    fd_ = mkstemp(&path[0]);
+    if (fd_ == -1)
+        throw std::invalid_argument("could not create sort file in " + tmp_dir + ": " + strerror(errno));
+    // the file is only reachable through the descriptor, and goes with it
+    unlink(path.c_str());
+
+    for (size_t i = 0; i < workers + 1; ++i)
+        buffers_.emplace_back(new run_buffer(arena_len));
+    out_.size = 0;
+}
+
+record_external_sort::~record_external_sort()
+{
+    for (auto& buffer : buffers_)
+    {
+        if (buffer->thread.joinable())
+            buffer->thread.join();
+    }
+    if (fd_ != -1)
+        close(fd_);
+}
+
+bool record_external_sort::operator()(record_batch& batch)
+{
+    if (ended_ || failed_)
+        return false;
+    for (size_t i = 0; i < batch.size; ++i)
+    {
+        const read_record_t& record = batch.records[i];
+        const record_time_t& time = batch.times[i];
+        if (record.status != read_record_t::ok || time.status < 0)
+        {
+            end_.record = record;
+            end_.time = time;
+            if (record.len_capture && record.data)
+                end_payload_.assign(record.data, record.data + record.len_capture);
+            else
+                end_.record.len_capture = 0;
+            ended_ = true;
+            return false;
+        }
+
+        const pstime_t key = time.status == record_time_t::ok ? time.hw_time : latest_;
+        if (latest_ < key)
+            latest_ = key;
+        if (!hold(record, time, key))
+            return false;
+    }
+    return true;
+}
+
+bool record_external_sort::hold(const read_record_t& record, const record_time_t& time, const pstime_t& key)
+{
+    const size_t len = spilled_len(record);
+    run_buffer* buffer = buffers_[current_].get();
+    if (buffer->used + len + (buffer->entries + 1) * sizeof(run_entry) > buffer->len)
+    {
+        if (!spill())
+            return false;
+        buffer = buffers_[current_].get();
+    }
+
+    spilled_record held;
+    held.key = key;
+    held.seq = seq_++;
+    held.record = record;
+    held.record.data = nullptr;
+    held.time = time;
+    char* at = &buffer->arena[buffer->used];
+    memcpy(at, &held, sizeof(held));
+    if (record.len_capture)
+        memcpy(at + sizeof(held), record.data, record.len_capture);
+    buffer->used += len;
+
+    ++buffer->entries;
+    run_entry& entry = buffer->index()[0];
+    entry.key = key;
+    entry.seq = held.seq;
+    entry.held = reinterpret_cast<const spilled_record*>(at);
+    return true;
+}
+
+bool record_external_sort::spill()
+{
+    run_buffer& buffer = *buffers_[current_];
+    const uint64_t offset = spill_len_;
+    spill_len_ += buffer.used;
+    runs_.push_back({offset, spill_len_});
+    ++spilled_runs_;
+    buffer.thread = std::thread([this, &buffer, offset]
+    {
+        buffer.error = write_run(buffer, offset) ? 0 : errno;
+    });
+
+    // the oldest buffer spilled is filled next
+    current_ = (current_ + 1) % buffers_.size();
+    return wait(*buffers_[current_]);
+}
+
+bool record_external_sort::write_run(run_buffer& buffer, uint64_t offset)
+{
+    run_entry* index = buffer.index();
+    std::sort(index, index + buffer.entries, [](const run_entry& a, const run_entry& b)
+              { return earlier(a.key, a.seq, b.key, b.seq); });
+
+    if (!buffer.staging)
+        buffer.staging.reset(new char[staging_len]);
+    size_t fill = 0;
+    for (size_t i = 0; i < buffer.entries; ++i)
+    {
+        const size_t len = spilled_len(index[i].held->record);
+        if (fill + len > staging_len)
+        {
+            if (!pwrite_all(fd_, &buffer.staging[0], fill, offset))
+                return false;
+            offset += fill;
+            fill = 0;
+        }
+        memcpy(&buffer.staging[fill], index[i].held, len);
+        fill += len;
+    }
+    return pwrite_all(fd_, &buffer.staging[0], fill, offset);
+}
+
+bool record_external_sort::wait(run_buffer& buffer)
+{
+    if (buffer.thread.joinable())
+        buffer.thread.join();
+    buffer.used = 0;
+    buffer.entries = 0;
+    if (buffer.error)
+    {
+        log_ << "Problem writing sort run: " << strerror(buffer.error) << std::endl;
+        failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool record_external_sort::merge(const std::vector<run>& runs, size_t read_len,
+                                 const std::atomic<int>& running,
+                                 const std::function<bool(const spilled_record&, const char*)>& emit)
+{
+    std::vector<std::unique_ptr<run_cursor>> cursors;
+    std::vector<const spilled_record*> heads(runs.size());
+    std::vector<const char*> payloads(runs.size());
+    std::vector<size_t> heap;
+    auto order = [&heads](size_t a, size_t b)
+                 { return earlier(heads[b]->key, heads[b]->seq, heads[a]->key, heads[a]->seq); };
+
+    int got = 0;
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        cursors.emplace_back(new run_cursor(fd_, runs[i], read_len));
+        got = cursors[i]->next(heads[i], payloads[i]);
+        if (got < 0)
+            break;
+        if (got)
+        {
+            heap.push_back(i);
+            std::push_heap(heap.begin(), heap.end(), order);
+        }
+    }
+
+    while (got >= 0 && !heap.empty() && running.load(std::memory_order_relaxed))
+    {
+        std::pop_heap(heap.begin(), heap.end(), order);
+        const size_t i = heap.back();
+        if (!emit(*heads[i], payloads[i]))
+            return false;
+        got = cursors[i]->next(heads[i], payloads[i]);
+        if (got > 0)
+            std::push_heap(heap.begin(), heap.end(), order);
+        else
+            heap.pop_back();
+    }
+    if (got < 0)
+    {
+        log_ << "Problem reading sort run: " << strerror(errno) << std::endl;
+        failed_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool record_external_sort::pass_on(const spilled_record& held, const char* payload)
+{
+    if (out_.size == out_.capacity && !write_out())
+        return false;
+    const size_t i = out_.size++;
+    out_.records[i] = held.record;
+    out_.times[i] = held.time;
+    memcpy(out_.slot(i), payload, held.record.len_capture);
+    out_.records[i].data = out_.slot(i);
+    return true;
+}
+
+bool record_external_sort::write_out()
+{
+    if (!out_.size)
+        return !stopped_;
+    if (!sink_(out_))
+        stopped_ = true;
+    out_.size = 0;
+    return !stopped_;
+}
+
+bool record_external_sort::flush(const std::atomic<int>& running)
+{
+    if (stopped_ || failed_)
+        return false;
+    auto pass = [this](const spilled_record& held, const char* payload)
+                { return pass_on(held, payload); };
+
+    run_buffer& held = *buffers_[current_];
+    if (runs_.empty())
+    {
+        // everything fitted in memory
+        run_entry* index = held.index();
+        std::sort(index, index + held.entries, [](const run_entry& a, const run_entry& b)
+                  { return earlier(a.key, a.seq, b.key, b.seq); });
+        for (size_t i = 0; i < held.entries && running; ++i)
+        {
+            const char* payload = reinterpret_cast<const char*>(index[i].held) + sizeof(spilled_record);
+            if (!pass_on(*index[i].held, payload))
+                return false;
+        }
+        held.entries = 0;
+    }
+    else
+    {
+        if (held.entries && !spill())
+            return false;
+        for (auto& buffer : buffers_)
+        {
+            if (!wait(*buffer))
+                return false;
+        }
+        // the budget goes to the read buffers from here on
+        buffers_.clear();
+
+        // each pass merges as many runs as can be read at once, with one
+        // more buffer for the run written
+        const size_t max_runs = std::max<size_t>(2, memory_len_ / min_read_len - 1);
+        while (runs_.size() > max_runs && running)
+        {
+            const std::vector<run> merged(runs_.begin(), runs_.begin() + max_runs);
+            const size_t read_len = memory_len_ / (max_runs + 1);
+            std::unique_ptr<char[]> staging(new char[read_len]);
+            const uint64_t begin = spill_len_;
+            size_t fill = 0;
+            auto write = [&](const spilled_record& record, const char*)
+            {
+                const size_t len = spilled_len(record.record);
+                if (fill + len > read_len)
+                {
+                    if (!pwrite_all(fd_, &staging[0], fill, spill_len_))
+                        return false;
+                    spill_len_ += fill;
+                    fill = 0;
+                }
+                memcpy(&staging[fill], &record, len);
+                fill += len;
+                return true;
+            };
+            const bool ok = merge(merged, read_len, running, write);
+            if (!ok || !pwrite_all(fd_, &staging[0], fill, spill_len_))
+            {
+                if (!failed_)
+                    log_ << "Problem writing sort run: " << strerror(errno) << std::endl;
+                failed_ = true;
+                return false;
+            }
+            spill_len_ += fill;
+
+            // space of the merged runs is released where the file system
+            // supports it
+            for (const run& r : merged)
+                (void)fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, r.begin, r.end - r.begin);
+            runs_.erase(runs_.begin(), runs_.begin() + max_runs);
+            runs_.push_back({begin, spill_len_});
+            ++merge_passes_;
+        }
+
+        const size_t read_len = std::max(min_read_len, memory_len_ / runs_.size());
+        if (!merge(runs_, read_len, running, pass))
+            return false;
+        ++merge_passes_;
+    }
+
+    if (ended_ && running)
+    {
+        if (!pass_on(end_, end_payload_.data()))
+            return false;
+    }
+    return write_out();
+}
+
+void record_external_sort::print_stats(std::ostream& os) const
+{
+    os << "Sort: " << seq_ << " records, " << spilled_runs_ << " runs of "
+       << spill_len_ << " bytes spilled, " << merge_passes_ << " merge passes" << std::endl;
+}
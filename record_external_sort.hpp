@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include "pstime.hpp"
+#include "record_batch.hpp"
+
+/*
+ * Sorts a whole capture by hardware time within a fixed memory budget.
+ * Decoded records are copied into one of several run buffers; a full
+ * buffer is sorted and spilled as a run to a temporary file on a thread
+ * of its own while the next buffer is filled. Once the input ends the runs
+ * are merged, several passes over the file if there are more runs than
+ * can be read at once within the budget, and the last pass is passed on
+ * in time order. Input that fits in a single buffer is never spilled.
+ * Records that did not decode are held at the latest time seen so they
+ * stay near their neighbours; the end of input, read errors and
+ * unrecoverable records end the input and are passed on last.
+ */
+struct record_external_sort
+{
+    using sink_t = std::function<bool(record_batch&)>;
+
+    // memory_len bytes hold records, spilled by up to jobs threads at once;
+    // runs go to an unlinked file in tmp_dir. Will throw if the file cannot
+    // be created or the budget is too small
+    record_external_sort(size_t memory_len, unsigned jobs, const std::string& tmp_dir,
+                         size_t batch_len, size_t slot_len, const sink_t& sink, std::ostream& log);
+    ~record_external_sort();
+
+    record_external_sort(const record_external_sort&) = delete;
+    void operator=(const record_external_sort&) = delete;
+
+    // as a batch sink, false once the input has ended or a run could not
+    // be written
+    bool operator()(record_batch& batch);
+
+    // merge and pass on everything held, stopping early if running is
+    // cleared; false if the sink stopped or the spill file failed
+    bool flush(const std::atomic<int>& running);
+
+    // a run could not be written or read back
+    bool failed() const { return failed_; }
+
+    void print_stats(std::ostream& os) const;
+
+private:
+    // each spilling thread stages its writes in a buffer this long
+    static const size_t staging_len = 1 << 20;
+    // shortest read buffer per run when merging, which bounds the runs
+    // merged in a single pass
+    static const size_t min_read_len = 1 << 20;
+
+    // a record as held in a run buffer and in the spill file, followed by
+    // its payload padded to 8 bytes
+    struct spilled_record
+    {
+        pstime_t key = pstime_t(0, 0);
+        // arrival order, for a stable sort
+        uint64_t seq = 0;
+        read_record_t record = read_record_t();
+        record_time_t time = record_time_t();
+    };
+
+    // sort index, kept at the end of the run buffer growing down
+    struct run_entry
+    {
+        pstime_t key;
+        uint64_t seq;
+        const spilled_record* held;
+    };
+
+    // records from begin to end of the spill file, in time order
+    struct run
+    {
+        uint64_t begin;
+        uint64_t end;
+    };
+
+    struct run_buffer
+    {
+        std::unique_ptr<char[]> arena;
+        std::unique_ptr<char[]> staging;
+        size_t len;
+        size_t used;
+        size_t entries;
+        // errno of a failed spill, read once the thread is joined
+        int error;
+        std::thread thread;
+
+        run_buffer(size_t arena_len);
+        run_entry* index() { return reinterpret_cast<run_entry*>(arena.get() + len) - entries; }
+    };
+
+    struct run_cursor;
+
+    static size_t spilled_len(const read_record_t& record);
+
+    bool hold(const read_record_t& record, const record_time_t& time, const pstime_t& key);
+    bool spill();
+    bool write_run(run_buffer& buffer, uint64_t offset);
+    bool wait(run_buffer& buffer);
+    bool merge(const std::vector<run>& runs, size_t read_len, const std::atomic<int>& running,
+               const std::function<bool(const spilled_record&, const char*)>& emit);
+    bool pass_on(const spilled_record& held, const char* payload);
+    bool write_out();
+
+    const size_t memory_len_;
+    const sink_t sink_;
+    std::ostream& log_;
+    int fd_;
+    std::vector<std::unique_ptr<run_buffer>> buffers_;
+    // buffer being filled
+    size_t current_;
+    std::vector<run> runs_;
+    uint64_t spill_len_;
+    record_batch out_;
+    // the record that ended the input, passed on after the sorted records
+    spilled_record end_;
+    std::vector<char> end_payload_;
+    bool ended_;
+    bool stopped_;
+    bool failed_;
+    uint64_t seq_;
+    pstime_t latest_;
+    uint64_t spilled_runs_;
+    unsigned merge_passes_;
+};
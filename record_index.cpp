@@ -0,0 +1,270 @@
+#include "record_index.hpp"
+#include "record_reader.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include <sys/stat.h>
+
+// bytes of capture between checkpoints
+static const uint64_t checkpoint_interval = 1 << 20;
+
+// on disk layout, native byte order like the pcap files that are read
+struct index_file_header
+{
+    static const uint32_t index_magic = 0x78647374; // "tsdx"
+    static const uint32_t index_version = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t file_size;
+    int64_t file_mtime;
+    int32_t timestamp_format;
+    int32_t time_offset_end;
+    uint64_t keyframes;
+    uint64_t checkpoints;
+};
+
+struct index_file_keyframe
+{
+    uint64_t offset;
+    uint64_t utc_nanos;
+    uint64_t counter;
+    uint64_t freq;
+    int64_t clock_sec;
+    uint64_t clock_psec;
+    uint32_t clock_precision;
+    uint32_t arista_compat;
+};
+
+struct index_file_checkpoint
+{
+    uint64_t offset;
+    uint64_t record;
+    int64_t hw_sec;
+    uint64_t hw_psec;
+    uint32_t hw_precision;
+    uint32_t reserved;
+    int64_t keyframe;
+};
+
+static bool capture_stat(const std::string& capture, uint64_t& size, int64_t& mtime)
+{
+    struct stat stats;
+    if (stat(capture.c_str(), &stats) != 0 || !S_ISREG(stats.st_mode))
+        return false;
+    size = stats.st_size;
+    mtime = stats.st_mtim.tv_sec * 1000000000LL + stats.st_mtim.tv_nsec;
+    return true;
+}
+
+std::string record_index::path(const std::string& capture)
+{
+    return capture + ".tsidx";
+}
+
+std::unique_ptr<record_index> record_index::build(const read_options& read,
+                                                  const process_options& process)
+{
+    std::unique_ptr<record_index> index(new record_index());
+    if (!capture_stat(read.source, index->file_size, index->file_mtime))
+        throw std::invalid_argument(std::string("can only index a pcap file"));
+
+    std::unique_ptr<record_reader> reader = record_reader::pcap(read);
+    if (reader->tell() < 0)
+        throw std::invalid_argument(std::string("can only index a pcap file"));
+
+    record_process proc(process);
+    std::vector<char> buffer(0x10080);
+    uint64_t record_number = 0;
+    uint64_t next_checkpoint = 0;
+    while (true)
+    {
+        const uint64_t offset = reader->tell();
+        read_record_t record = reader->next(buffer.data(), buffer.size());
+        if (record.status == read_record_t::eof)
+            break;
+        if (record.status != read_record_t::ok)
+            throw std::invalid_argument(std::string("problem reading record"));
+
+        const record_time_t timed = proc.process(record, buffer.data(), buffer.size());
+        // decoding stops at an unrecoverable error, so does the index
+        if (timed.status < 0)
+            break;
+        if (timed.status == record_time_t::ok)
+        {
+            if (timed.is_keyframe)
+            {
+                keyframe_entry entry;
+                entry.offset = offset;
+                entry.data = proc.keyframe();
+                index->keyframes.push_back(entry);
+            }
+            if (offset >= next_checkpoint)
+            {
+                checkpoint point;
+                point.offset = offset;
+                point.record = record_number;
+                point.hw_time = timed.hw_time;
+                point.keyframe = int64_t(index->keyframes.size()) - 1;
+                index->checkpoints.push_back(point);
+                next_checkpoint = offset + checkpoint_interval;
+            }
+        }
+        ++record_number;
+    }
+
+    const process_options detected = proc.detected_options();
+    index->timestamp_format = detected.timestamp_format;
+    index->time_offset_end = detected.time_offset_end;
+    return index;
+}
+
+std::unique_ptr<record_index> record_index::load(const std::string& capture)
+{
+    std::unique_ptr<record_index> index;
+    uint64_t size;
+    int64_t mtime;
+    if (!capture_stat(capture, size, mtime))
+        return index;
+
+    std::ifstream is(path(capture).c_str(), std::ios::binary);
+    index_file_header header;
+    if (!is.read(reinterpret_cast<char*>(&header), sizeof(header))
+        || header.magic != index_file_header::index_magic
+        || header.version != index_file_header::index_version
+        || header.file_size != size || header.file_mtime != mtime)
+    {
+        return index;
+    }
+
+    // the counts are only trusted as far as the file holds them
+    is.seekg(0, std::ios::end);
+    const uint64_t body = uint64_t(is.tellg()) - sizeof(header);
+    if (!is || header.keyframes > body / sizeof(index_file_keyframe))
+        return index;
+    const uint64_t rest = body - header.keyframes * sizeof(index_file_keyframe);
+    if (rest % sizeof(index_file_checkpoint)
+        || header.checkpoints != rest / sizeof(index_file_checkpoint))
+    {
+        return index;
+    }
+    is.seekg(sizeof(header));
+
+    std::vector<index_file_keyframe> keyframes(header.keyframes);
+    std::vector<index_file_checkpoint> checkpoints(header.checkpoints);
+    if (!is.read(reinterpret_cast<char*>(keyframes.data()), keyframes.size() * sizeof(keyframes[0]))
+        || !is.read(reinterpret_cast<char*>(checkpoints.data()), checkpoints.size() * sizeof(checkpoints[0])))
+    {
+        return index;
+    }
+
+    for (const index_file_checkpoint& cp : checkpoints)
+    {
+        if (cp.keyframe < -1 || cp.keyframe >= int64_t(keyframes.size()))
+            return index;
+    }
+
+    index.reset(new record_index());
+    index->file_size = header.file_size;
+    index->file_mtime = header.file_mtime;
+    index->timestamp_format = header.timestamp_format;
+    index->time_offset_end = header.time_offset_end;
+    index->keyframes.reserve(keyframes.size());
+    for (const index_file_keyframe& kf : keyframes)
+    {
+        keyframe_entry entry;
+        entry.offset = kf.offset;
+        entry.data.utc_nanos = kf.utc_nanos;
+        entry.data.counter = kf.counter;
+        entry.data.freq = kf.freq;
+        entry.data.arista_compat = kf.arista_compat;
+        entry.data.clock_time = pstime_t(kf.clock_sec, kf.clock_psec, kf.clock_precision);
+        index->keyframes.push_back(entry);
+    }
+    index->checkpoints.reserve(checkpoints.size());
+    for (const index_file_checkpoint& cp : checkpoints)
+    {
+        checkpoint point;
+        point.offset = cp.offset;
+        point.record = cp.record;
+        point.hw_time = pstime_t(cp.hw_sec, cp.hw_psec, cp.hw_precision);
+        point.keyframe = cp.keyframe;
+        index->checkpoints.push_back(point);
+    }
+    return index;
+}
+
+void record_index::save(const std::string& capture) const
+{
+    index_file_header header;
+    header.magic = index_file_header::index_magic;
+    header.version = index_file_header::index_version;
+    header.file_size = file_size;
+    header.file_mtime = file_mtime;
+    header.timestamp_format = timestamp_format;
+    header.time_offset_end = time_offset_end;
+    header.keyframes = keyframes.size();
+    header.checkpoints = checkpoints.size();
+
+    // write to the side and rename, so readers never see a partial index
+    const std::string fname = path(capture);
+    const std::string temp = fname + ".tmp";
+    std::ofstream os(temp.c_str(), std::ios::binary | std::ios::trunc);
+    os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (const keyframe_entry& entry : keyframes)
+    {
+        index_file_keyframe kf;
+        kf.offset = entry.offset;
+        kf.utc_nanos = entry.data.utc_nanos;
+        kf.counter = entry.data.counter;
+        kf.freq = entry.data.freq;
+        kf.clock_sec = entry.data.clock_time.sec;
+        kf.clock_psec = entry.data.clock_time.psec;
+        kf.clock_precision = entry.data.clock_time.precision;
+        kf.arista_compat = entry.data.arista_compat;
+        os.write(reinterpret_cast<const char*>(&kf), sizeof(kf));
+    }
+    for (const checkpoint& point : checkpoints)
+    {
+        index_file_checkpoint cp;
+        cp.offset = point.offset;
+        cp.record = point.record;
+        cp.hw_sec = point.hw_time.sec;
+        cp.hw_psec = point.hw_time.psec;
+        cp.hw_precision = point.hw_time.precision;
+        cp.reserved = 0;
+        cp.keyframe = point.keyframe;
+        os.write(reinterpret_cast<const char*>(&cp), sizeof(cp));
+    }
+    os.close();
+    if (!os || std::rename(temp.c_str(), fname.c_str()) != 0)
+    {
+        std::remove(temp.c_str());
+        throw std::invalid_argument(std::string("could not write index ") + fname);
+    }
+}
+
+const record_index::checkpoint* record_index::find(const pstime_t& time) const
+{
+    auto it = std::upper_bound(checkpoints.begin(), checkpoints.end(), time,
+                               [](const pstime_t& t, const checkpoint& point)
+                               { return t < point.hw_time; });
+    if (it == checkpoints.begin())
+        return nullptr;
+    return &*(it - 1);
+}
+
+process_options record_index::decode_options(const process_options& opt) const
+{
+    process_options decode = opt;
+    if (decode.timestamp_format == process_options::timestamp_format_auto)
+    {
+        decode.timestamp_format = timestamp_format;
+        decode.time_offset_end = time_offset_end;
+    }
+    else if (decode.timestamp_format == timestamp_format && decode.time_offset_end == -1)
+        decode.time_offset_end = time_offset_end;
+    return decode;
+}
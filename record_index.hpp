@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "options.hpp"
+#include "pstime.hpp"
+#include "record_process.hpp"
+
+/*
+ * Sidecar index for a pcap file, kept next to it as <file>.tsidx.
+ * Records every keyframe with the decoder state it gives, and sparse
+ * checkpoints from hardware time to record offsets, so a later run can seek
+ * to a point in time and decode from there with the right keyframe state
+ * without reading the earlier part of the capture.
+ */
+struct record_index
+{
+    struct keyframe_entry
+    {
+        uint64_t offset = 0;
+        record_process::keyframe_data data = record_process::keyframe_data();
+    };
+
+    struct checkpoint
+    {
+        // the first record decoded ok in each checkpoint interval
+        uint64_t offset = 0;
+        uint64_t record = 0;
+        pstime_t hw_time = pstime_t(0, 0);
+        // keyframe in effect at the record, -1 if none has been seen
+        int64_t keyframe = -1;
+    };
+
+    // size and modification time (ns) of the capture when indexed, an
+    // index that does not match is ignored
+    uint64_t file_size = 0;
+    int64_t file_mtime = 0;
+    // timestamp format and offset found while indexing
+    int timestamp_format = process_options::timestamp_format_auto;
+    int time_offset_end = -1;
+    std::vector<keyframe_entry> keyframes = std::vector<keyframe_entry>();
+    // in file order, hardware time is assumed not to go backwards
+    std::vector<checkpoint> checkpoints = std::vector<checkpoint>();
+
+    static std::string path(const std::string& capture);
+
+    // decode the whole capture, will throw if it cannot be read
+    static std::unique_ptr<record_index> build(const read_options& read,
+                                               const process_options& process);
+
+    // returns empty index if there is none, it does not match the capture
+    // or it is not consistent
+    static std::unique_ptr<record_index> load(const std::string& capture);
+
+    // will throw if the index cannot be written
+    void save(const std::string& capture) const;
+
+    // the last checkpoint at or before time, null if there is none
+    const checkpoint* find(const pstime_t& time) const;
+
+    // options for decoding with the format found while indexing, unless
+    // they were given explicitly
+    process_options decode_options(const process_options& opt) const;
+};
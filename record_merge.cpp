@@ -0,0 +1,283 @@
+#include "record_merge.hpp"
+#include "record_pipeline.hpp"
+#include "record_profile.hpp"
+#include "record_reader.hpp"
+#include <algorithm>
+#include <chrono>
+
+record_merge::input::input(std::unique_ptr<record_reader> r, const process_options& process,
+                           const std::string& n, int c, size_t batch_len, size_t slot_len,
+                           bool low_jitter)
+: reader(std::move(r))
+, proc(process)
+, name(n)
+, cpu(c)
+, live(reader->live())
+, batches()
+, free(prefetch_batches)
+, full(prefetch_batches)
+, done(false)
+, current(-1)
+, pos(0)
+, last(0, 0)
+, merged(0)
+, merged_bytes(0)
+, stats()
+, thread()
+{
+    for (size_t i = 0; i < prefetch_batches; ++i)
+    {
+        batches.emplace_back(new record_batch(batch_len, slot_len, low_jitter));
+        free.push(i);
+    }
+}
+
+record_merge::record_merge(const thread_options& opt, size_t batch_len, size_t slot_len,
+                           record_profile* profile)
+: options_(opt)
+, profile_(profile)
+, batch_len_(batch_len)
+, slot_len_(slot_len)
+, inputs_()
+, stop_(false)
+, merge_waits_(0)
+, elapsed_(0)
+{}
+
+record_merge::~record_merge()
+{}
+
+void record_merge::add_input(std::unique_ptr<record_reader> reader, const process_options& process,
+                             const std::string& name)
+{
+    const size_t i = inputs_.size();
+    const int cpu = i < options_.cpu_inputs.size() ? options_.cpu_inputs[i] : -1;
+    inputs_.emplace_back(new input(std::move(reader), process, name, cpu, batch_len_, slot_len_,
+                                   options_.low_jitter));
+}
+
+void record_merge::prefetch(input& in, const std::atomic<int>& running)
+{
+    tune_polling_thread("input " + in.name, in.cpu, options_.fifo_priority,
+                        options_.low_jitter || options_.fifo_priority);
+
+    size_t index;
+    unsigned spins = 0;
+    while (running && !stop_)
+    {
+        if (!in.free.pop(index))
+        {
+            wait_idle(spins, options_.low_jitter);
+            continue;
+        }
+        spins = 0;
+
+        record_batch& batch = *in.batches[index];
+        size_t count = 0;
+        while (!count && running && !stop_)
+        {
+            stage_timer timer(profile_);
+            count = in.reader->next_batch(batch);
+            timer.done(record_profile::read, batch, count);
+            // a live input with nothing arriving
+            if (!count)
+                wait_idle(spins, options_.low_jitter);
+        }
+        spins = 0;
+        if (!count)
+            break;
+
+        stage_timer timer(profile_);
+        const size_t decoded = in.proc.process_batch(batch);
+        timer.done(record_profile::decode, batch, count);
+        in.full.push(index);
+        // the input ends at eof, a read error or an unrecoverable record
+        if (batch.records[count - 1].status != read_record_t::ok
+            || (decoded && batch.times[decoded - 1].status < 0))
+            break;
+    }
+    in.stats = in.reader->stats();
+    in.done.store(true, std::memory_order_release);
+}
+
+record_merge::fetch_t record_merge::next_batch(input& in, const std::atomic<int>& running)
+{
+    size_t index;
+    unsigned spins = 0;
+    while (!in.full.pop(index))
+    {
+        // the last batch is pushed before done is set
+        if (in.done.load(std::memory_order_acquire))
+        {
+            if (in.full.pop(index))
+                break;
+            return ended;
+        }
+        if (!running || stop_)
+            return ended;
+        if (in.live)
+            return idle;
+        if (!spins)
+            ++merge_waits_;
+        wait_idle(spins, options_.low_jitter);
+    }
+    in.current = index;
+    in.pos = 0;
+    return fetched;
+}
+
+pstime_t record_merge::key(const input& in) const
+{
+    const record_batch& batch = *in.batches[in.current];
+    if (batch.records[in.pos].status == read_record_t::ok
+        && batch.times[in.pos].status == record_time_t::ok)
+        return batch.times[in.pos].hw_time;
+    return in.last;
+}
+
+void record_merge::run(const sink_t& sink, const std::atomic<int>& running, const idle_t& on_idle)
+{
+    for (auto& in : inputs_)
+        in->thread = std::thread(&record_merge::prefetch, this, std::ref(*in), std::cref(running));
+
+    // min heap on the time of each input's next record, then input order
+    typedef std::pair<pstime_t, size_t> entry;
+    auto later = [](const entry& a, const entry& b)
+    {
+        return b.first < a.first || (!(a.first < b.first) && a.second > b.second);
+    };
+    std::vector<entry> heap;
+    // live inputs with nothing ready, rejoining the heap once they have
+    std::vector<size_t> waiting;
+    auto join = [&](size_t i)
+    {
+        switch (next_batch(*inputs_[i], running))
+        {
+        case fetched:
+            heap.push_back(entry(key(*inputs_[i]), i));
+            std::push_heap(heap.begin(), heap.end(), later);
+            break;
+        case idle:
+            waiting.push_back(i);
+            break;
+        case ended:
+            break;
+        }
+    };
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < inputs_.size(); ++i)
+        join(i);
+
+    // input batches referenced by the output batch, recycled once it is written
+    record_batch out(batch_len_, 0);
+    out.size = 0;
+    std::vector<std::pair<input*, size_t>> held;
+    auto flush = [&]()
+    {
+        stage_timer timer(profile_);
+        const bool written = !out.size || sink(out);
+        timer.done(record_profile::write, out, out.size);
+        out.size = 0;
+        for (auto& batch : held)
+            batch.first->free.push(batch.second);
+        held.clear();
+        return written;
+    };
+
+    bool more = true;
+    unsigned spins = 0;
+    while (more && (!heap.empty() || !waiting.empty()) && running && !stop_)
+    {
+        for (size_t j = 0; j < waiting.size();)
+        {
+            const input& in = *inputs_[waiting[j]];
+            if (in.full.empty() && !in.done.load(std::memory_order_acquire))
+            {
+                ++j;
+                continue;
+            }
+            const size_t i = waiting[j];
+            waiting.erase(waiting.begin() + j);
+            join(i);
+        }
+        if (heap.empty())
+        {
+            // write out what is held while every input is idle
+            if (out.size || !held.empty())
+                more = flush();
+            if (on_idle)
+                on_idle();
+            wait_idle(spins, options_.low_jitter);
+            continue;
+        }
+        spins = 0;
+
+        std::pop_heap(heap.begin(), heap.end(), later);
+        const size_t i = heap.back().second;
+        heap.pop_back();
+        input& in = *inputs_[i];
+
+        const record_batch& batch = *in.batches[in.current];
+        const read_record_t& record = batch.records[in.pos];
+        bool ended = record.status == read_record_t::eof;
+        if (!ended)
+        {
+            in.last = key(in);
+            out.records[out.size] = record;
+            out.times[out.size] = (record.status == read_record_t::ok) ? batch.times[in.pos]
+                                                                       : record_time_t();
+            ++out.size;
+            ++in.merged;
+            in.merged_bytes += record.len_orig;
+            // the sink stops at a read error or an unrecoverable record
+            ended = record.status != read_record_t::ok || batch.times[in.pos].status < 0;
+        }
+
+        if (ended || ++in.pos == batch.size)
+        {
+            held.push_back(std::make_pair(&in, size_t(in.current)));
+            in.current = -1;
+            // let the input read on if it has nothing ready
+            if (!ended && in.full.empty())
+                more = flush();
+        }
+        if (more && !ended)
+        {
+            if (in.current != -1)
+            {
+                heap.push_back(entry(key(in), i));
+                std::push_heap(heap.begin(), heap.end(), later);
+            }
+            else
+                join(i);
+        }
+
+        if (out.size == out.capacity)
+            more = flush();
+    }
+    if (more)
+        flush();
+
+    elapsed_ = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    stop_ = true;
+    for (auto& in : inputs_)
+        in->thread.join();
+}
+
+void record_merge::print_stats(std::ostream& os) const
+{
+    os << "Merge: " << inputs_.size() << " inputs, records";
+    for (const auto& in : inputs_)
+        os << ' ' << in->merged;
+    os << ", waits for an input " << merge_waits_ << std::endl;
+
+    const double seconds = elapsed_ > 0 ? elapsed_ : 1;
+    for (const auto& in : inputs_)
+    {
+        os << "Input " << in->name << ": records " << in->merged
+           << " (" << uint64_t(in->merged / seconds) << "/s, "
+           << in->merged_bytes * 8 / seconds / 1e6 << " Mbps), dropped "
+           << in->stats.dropped << ", overflows " << in->stats.overflows << std::endl;
+    }
+}
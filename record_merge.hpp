@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "options.hpp"
+#include "pstime.hpp"
+#include "record_batch.hpp"
+#include "record_process.hpp"
+#include "record_reader.hpp"
+#include "spsc_ring.hpp"
+
+struct record_profile;
+
+/*
+ * Merges several captures into one stream ordered by decoded hardware time.
+ * Each input is read and decoded ahead on its own thread into a few batches
+ * of its own, handed over on rings of batch indices. The calling thread
+ * repeatedly takes the input whose next record is earliest, collecting the
+ * records into output batches that point at the payloads in the input
+ * batches, which are only recycled once the output has been written.
+ * Records that did not decode take the time of the record before them in
+ * their input, so they are passed on in place and errors are reported.
+ * Live inputs are not waited for: one with nothing ready is set aside and
+ * rejoins the merge once it has, so an idle port does not hold up the
+ * others. Its records may then be behind those already merged by as long
+ * as its thread took to read them, which a sort window after the merge
+ * puts back in order.
+ */
+struct record_merge
+{
+    // called on the calling thread with each merged batch, return false to stop
+    using sink_t = std::function<bool(record_batch&)>;
+    // called on the calling thread while every input is idle
+    using idle_t = std::function<void()>;
+
+    // each stage of each batch is timed into profile unless it is null
+    record_merge(const thread_options& opt, size_t batch_len, size_t slot_len,
+                 record_profile* profile = nullptr);
+    ~record_merge();
+
+    record_merge(const record_merge&) = delete;
+    void operator=(const record_merge&) = delete;
+
+    // inputs are merged in the order added when their times are equal; each
+    // is read on a thread pinned to its cpu in thread_options::cpu_inputs
+    void add_input(std::unique_ptr<record_reader> reader, const process_options& process,
+                   const std::string& name);
+
+    // returns once every input has ended and been merged, the sink returns
+    // false, or running is cleared
+    void run(const sink_t& sink, const std::atomic<int>& running,
+             const idle_t& on_idle = idle_t());
+
+    void print_stats(std::ostream& os) const;
+
+private:
+    // batches read ahead by each input
+    static const size_t prefetch_batches = 4;
+
+    enum fetch_t
+    {
+        fetched,
+        // a live input with nothing ready
+        idle,
+        ended,
+    };
+
+    struct input
+    {
+        std::unique_ptr<record_reader> reader;
+        record_process proc;
+        const std::string name;
+        const int cpu;
+        const bool live;
+        std::vector<std::unique_ptr<record_batch>> batches;
+        spsc_ring<size_t> free;
+        spsc_ring<size_t> full;
+        std::atomic<bool> done;
+        // batch being merged, -1 if none, and its next record
+        int current;
+        size_t pos;
+        // sort key of the last record merged
+        pstime_t last;
+        uint64_t merged;
+        uint64_t merged_bytes;
+        // losses of the source, taken once its thread has stopped reading
+        read_stats_t stats;
+        std::thread thread;
+
+        input(std::unique_ptr<record_reader> r, const process_options& process,
+              const std::string& name, int cpu, size_t batch_len, size_t slot_len,
+              bool low_jitter);
+    };
+
+    void prefetch(input& in, const std::atomic<int>& running);
+    // next batch of the input into current; a live input with nothing
+    // ready is idle rather than waited for
+    fetch_t next_batch(input& in, const std::atomic<int>& running);
+    pstime_t key(const input& in) const;
+
+    const thread_options options_;
+    record_profile* const profile_;
+    const size_t batch_len_;
+    const size_t slot_len_;
+    std::vector<std::unique_ptr<input>> inputs_;
+    std::atomic<bool> stop_;
+    uint64_t merge_waits_;
+    // seconds from the start of the merge to the end
+    double elapsed_;
+};
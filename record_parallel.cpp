@@ -0,0 +1,163 @@
+#include "record_parallel.hpp"
+#include "record_reader.hpp"
+#include "record_process.hpp"
+#include <thread>
+
+// input bytes per chunk, small enough to keep the decoded output of the
+// chunks in flight in memory
+static const uint64_t chunk_len = 4 << 20;
+
+record_parallel::record_parallel(const thread_options& opt, const process_options& process,
+                                 size_t buffer_len)
+: options_(opt)
+, process_(process)
+, buffer_len_(buffer_len)
+, lock_()
+, changed_()
+, chunks_()
+, results_()
+, next_chunk_(0)
+, committed_(0)
+, scan_done_(false)
+, stop_(false)
+{}
+
+bool record_parallel::add_chunk(const parallel_chunk& chunk)
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    // bound the chunks decoded but not yet committed
+    const size_t window = 4 * options_.jobs;
+    changed_.wait(guard, [&]{ return stop_ || chunks_.size() - committed_ < window; });
+    if (stop_)
+        return false;
+    chunks_.push_back(chunk);
+    changed_.notify_all();
+    return true;
+}
+
+void record_parallel::scan(record_reader& reader)
+{
+    // the worker decoding the first chunk reports what is detected
+    process_options quiet = process_;
+    quiet.verbose = 0;
+    record_process probe(quiet);
+    std::vector<char> scratch(buffer_len_);
+
+    parallel_chunk chunk;
+    chunk.begin = reader.tell();
+    chunk.process = process_;
+    int64_t keyframe = -1;
+    uint64_t records = 0;
+    bool detected = false;
+    bool need_keyframe = true;
+    while (true)
+    {
+        const int64_t offset = reader.tell();
+        read_record_t record = reader.next(scratch.data(), scratch.size());
+        // eof or a read error, the last chunk runs to the end of the file
+        // so that its worker sees the same
+        if (record.status != read_record_t::ok)
+            break;
+
+        // a chunk can start anywhere once decoding no longer depends on
+        // auto detection, and any keyframe state needed is known
+        if (detected && offset - chunk.begin >= chunk_len && (keyframe != -1 || !need_keyframe))
+        {
+            chunk.end = offset;
+            if (!add_chunk(chunk))
+                break;
+            chunk.begin = offset;
+            chunk.first_record = records;
+            chunk.keyframe = need_keyframe ? keyframe : -1;
+            chunk.process = probe.detected_options();
+            chunk.process.verbose = process_.verbose;
+        }
+
+        if (need_keyframe && record_process::is_keyframe(record))
+            keyframe = offset;
+        if (!detected)
+        {
+            probe.process(record, scratch.data(), scratch.size());
+            detected = probe.detected();
+            need_keyframe = !detected || probe.detected_options().timestamp_format
+                                         != process_options::timestamp_format_trailer;
+        }
+        ++records;
+    }
+
+    // fails harmlessly if already stopped
+    chunk.end = 0;
+    add_chunk(chunk);
+    std::lock_guard<std::mutex> guard(lock_);
+    scan_done_ = true;
+    changed_.notify_all();
+}
+
+void record_parallel::work(size_t worker, const decode_fn& decode)
+{
+    while (true)
+    {
+        size_t index;
+        parallel_chunk chunk;
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            changed_.wait(guard, [&]{ return stop_ || next_chunk_ < chunks_.size() || scan_done_; });
+            if (stop_ || next_chunk_ == chunks_.size())
+                return;
+            index = next_chunk_++;
+            chunk = chunks_[index];
+        }
+
+        std::unique_ptr<chunk_result> result = decode(chunk, worker);
+
+        std::lock_guard<std::mutex> guard(lock_);
+        results_[index] = std::move(result);
+        changed_.notify_all();
+    }
+}
+
+void record_parallel::run(record_reader& reader, const decode_fn& decode, const commit_fn& commit)
+{
+    std::thread scanner(&record_parallel::scan, this, std::ref(reader));
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < options_.jobs; ++i)
+        workers.emplace_back(&record_parallel::work, this, i, std::cref(decode));
+
+    while (true)
+    {
+        std::unique_ptr<chunk_result> result;
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            changed_.wait(guard, [&]{ return results_.count(committed_)
+                                      || (scan_done_ && committed_ == chunks_.size()); });
+            auto it = results_.find(committed_);
+            if (it == results_.end())
+                break;
+            result = std::move(it->second);
+            results_.erase(it);
+        }
+
+        const bool more = commit(*result);
+
+        std::lock_guard<std::mutex> guard(lock_);
+        ++committed_;
+        changed_.notify_all();
+        if (!more)
+            break;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+        changed_.notify_all();
+    }
+    scanner.join();
+    for (auto& worker : workers)
+        worker.join();
+}
+
+void record_parallel::print_stats(std::ostream& os) const
+{
+    os << "Parallel: " << chunks_.size() << " chunks decoded by "
+       << options_.jobs << " workers" << std::endl;
+}
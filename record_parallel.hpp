@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include "options.hpp"
+
+struct record_reader;
+
+/*
+ * A range of records in a seekable capture that can be decoded on its own:
+ * a processor created with the chunk's options, which has first processed
+ * the keyframe at offset keyframe, decodes the range exactly as a single
+ * processor reading the whole file would.
+ */
+struct parallel_chunk
+{
+    uint64_t begin = 0;
+    // zero for the end of the file
+    uint64_t end = 0;
+    // number of records in the file before begin
+    uint64_t first_record = 0;
+    // offset of the last keyframe before begin, -1 if none is needed
+    int64_t keyframe = -1;
+    // either the original options, or the detected format and offset
+    process_options process = process_options();
+};
+
+// output of decoding one chunk, handed back to the calling thread in order
+struct chunk_result
+{
+    virtual ~chunk_result() {}
+};
+
+/*
+ * Decodes a seekable capture on a pool of worker threads.
+ * The calling reader is used to scan the record headers, auto detecting
+ * the timestamp format with its own processor and tracking keyframe
+ * positions, then cutting the capture into chunks at record boundaries.
+ * Workers decode chunks in any order, results are committed in file order
+ * with a bounded number of chunks in flight.
+ */
+struct record_parallel
+{
+    // called on a worker thread, worker is in [0, jobs)
+    using decode_fn = std::function<std::unique_ptr<chunk_result>(const parallel_chunk& chunk, size_t worker)>;
+    // called on the calling thread in file order, return false to stop
+    using commit_fn = std::function<bool(chunk_result& result)>;
+
+    record_parallel(const thread_options& opt, const process_options& process, size_t buffer_len);
+
+    record_parallel(const record_parallel&) = delete;
+    void operator=(const record_parallel&) = delete;
+
+    void run(record_reader& reader, const decode_fn& decode, const commit_fn& commit);
+
+    void print_stats(std::ostream& os) const;
+
+private:
+    void scan(record_reader& reader);
+    bool add_chunk(const parallel_chunk& chunk);
+    void work(size_t worker, const decode_fn& decode);
+
+    const thread_options options_;
+    const process_options process_;
+    const size_t buffer_len_;
+
+    std::mutex lock_;
+    std::condition_variable changed_;
+    std::vector<parallel_chunk> chunks_;
+    std::map<size_t, std::unique_ptr<chunk_result>> results_;
+    size_t next_chunk_;
+    size_t committed_;
+    bool scan_done_;
+    bool stop_;
+};
@@ -0,0 +1,197 @@
+#include "record_pipeline.hpp"
+#include "record_reader.hpp"
+#include "record_process.hpp"
+#include "record_profile.hpp"
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+bool pin_thread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+void tune_polling_thread(const std::string& name, int cpu, int fifo_priority, bool report)
+{
+    std::string pinned = "any cpu";
+    if (cpu != -1)
+        pinned = pin_thread(cpu) ? "cpu " + std::to_string(cpu)
+                                 : "any cpu (could not pin to " + std::to_string(cpu) + ")";
+
+    std::string scheduling = "normal scheduling";
+    if (fifo_priority)
+    {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = fifo_priority;
+        const int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        scheduling = !err ? "SCHED_FIFO priority " + std::to_string(fifo_priority)
+                          : std::string("normal scheduling (SCHED_FIFO refused: ") + strerror(err) + ")";
+    }
+
+    if (report)
+        std::cerr << "Low jitter: " << name << " thread on " << pinned << ", "
+                  << scheduling << std::endl;
+}
+
+void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+void wait_idle(unsigned& spins, bool spin)
+{
+    if (spin || spins < 64)
+        cpu_relax();
+    else if (spins < 1024)
+        std::this_thread::yield();
+    else
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    if (spins < 1024)
+        ++spins;
+}
+
+record_pipeline::record_pipeline(const thread_options& opt, size_t batch_len, size_t slot_len,
+                                 record_profile* profile)
+: options_(opt)
+, profile_(profile)
+, batches_()
+, free_(opt.batches)
+, decode_(opt.batches)
+, write_(opt.batches)
+, capture_done_(false)
+, decode_done_(false)
+, stop_(false)
+, capture_waits_(0)
+{
+    // every ring can hold all batches, so only taking a free batch can stall
+    for (size_t i = 0; i < free_.capacity(); ++i)
+    {
+        batches_.emplace_back(new record_batch(batch_len, slot_len, opt.low_jitter));
+        free_.push(i);
+    }
+}
+
+void record_pipeline::capture(record_reader& reader, const std::atomic<int>& running)
+{
+    tune_polling_thread("capture", options_.cpu_capture, options_.fifo_priority,
+                        options_.low_jitter || options_.fifo_priority);
+
+    size_t index;
+    unsigned spins = 0;
+    while (running && !stop_)
+    {
+        if (!free_.pop(index))
+        {
+            if (!spins)
+                ++capture_waits_;
+            wait_idle(spins, options_.low_jitter);
+            continue;
+        }
+        spins = 0;
+
+        record_batch& batch = *batches_[index];
+        size_t count = 0;
+        while (!count && running && !stop_)
+        {
+            stage_timer timer(profile_);
+            count = reader.next_batch(batch);
+            timer.done(record_profile::read, batch, count);
+            // a live input with nothing arriving
+            if (!count)
+                wait_idle(spins, options_.low_jitter);
+        }
+        spins = 0;
+        if (!count)
+            break;
+
+        decode_.push(index);
+        if (batch.records[count - 1].status != read_record_t::ok)
+            break;
+    }
+    capture_done_.store(true, std::memory_order_release);
+}
+
+void record_pipeline::decode(record_process& proc)
+{
+    if (options_.cpu_decode != -1)
+        pin_thread(options_.cpu_decode);
+
+    size_t index;
+    unsigned spins = 0;
+    while (!stop_)
+    {
+        if (decode_.pop(index))
+        {
+            spins = 0;
+            record_batch& batch = *batches_[index];
+            stage_timer timer(profile_);
+            proc.process_batch(batch);
+            timer.done(record_profile::decode, batch, batch.size);
+            write_.push(index);
+        }
+        else if (capture_done_.load(std::memory_order_acquire) && decode_.empty())
+            break;
+        else
+            wait_idle(spins, options_.low_jitter);
+    }
+    decode_done_.store(true, std::memory_order_release);
+}
+
+void record_pipeline::run(record_reader& reader, record_process& proc, const sink_t& sink,
+                          const std::atomic<int>& running, const idle_t& idle)
+{
+    std::thread capture_thread(&record_pipeline::capture, this, std::ref(reader), std::cref(running));
+    std::thread decode_thread(&record_pipeline::decode, this, std::ref(proc));
+
+    if (options_.cpu_write != -1)
+        pin_thread(options_.cpu_write);
+
+    size_t index;
+    unsigned spins = 0;
+    while (!stop_)
+    {
+        if (write_.pop(index))
+        {
+            spins = 0;
+            record_batch& batch = *batches_[index];
+            stage_timer timer(profile_);
+            if (!sink(batch))
+                stop_ = true;
+            timer.done(record_profile::write, batch, batch.size);
+            free_.push(index);
+        }
+        else if (decode_done_.load(std::memory_order_acquire) && write_.empty())
+            break;
+        else
+        {
+            if (idle)
+                idle();
+            wait_idle(spins, options_.low_jitter);
+        }
+    }
+    stop_ = true;
+
+    capture_thread.join();
+    decode_thread.join();
+}
+
+void record_pipeline::print_stats(std::ostream& os) const
+{
+    os << "Pipeline: " << batches_.size() << " batches of "
+       << batches_.front()->capacity << " records"
+       << ", decode queue high watermark " << decode_.high_watermark()
+       << ", write queue high watermark " << write_.high_watermark()
+       << ", capture waits for a free batch " << capture_waits_
+       << std::endl;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "options.hpp"
+#include "record_batch.hpp"
+#include "spsc_ring.hpp"
+
+struct record_reader;
+struct record_process;
+struct record_profile;
+
+// pin the calling thread to a cpu, returns false if it could not be done
+bool pin_thread(int cpu);
+
+// pin the calling thread polling an input to cpu unless it is -1, and run
+// it at a SCHED_FIFO priority unless that is 0; reports what was achieved
+// to stderr if report is set
+void tune_polling_thread(const std::string& name, int cpu, int fifo_priority, bool report);
+
+// spin wait hint for polling loops
+void cpu_relax();
+
+// waits in a polling loop that found nothing, spins counting the polls in a
+// row that did, reset by the caller once one succeeds: spins briefly, then
+// yields and then sleeps so an idle thread gives up its cpu, unless spin is
+// set, for low jitter, when it only ever spins
+void wait_idle(unsigned& spins, bool spin);
+
+/*
+ * Runs reading, decoding and writing on separate threads, connected by
+ * rings of batch indices. The batches are allocated up front and cycle
+ * capture -> decode -> write -> free, so the capture thread only fills
+ * batches and never waits on decoding or output.
+ */
+struct record_pipeline
+{
+    // called on the write thread with each decoded batch, return false to stop
+    using sink_t = std::function<bool(record_batch&)>;
+    // called on the write thread while there is nothing to write
+    using idle_t = std::function<void()>;
+
+    // each stage of each batch is timed into profile unless it is null
+    record_pipeline(const thread_options& opt, size_t batch_len, size_t slot_len,
+                    record_profile* profile = nullptr);
+
+    record_pipeline(const record_pipeline&) = delete;
+    void operator=(const record_pipeline&) = delete;
+
+    // the calling thread is used as the write thread; returns once the
+    // reader has ended and everything read has been written, the sink
+    // returns false, or running is cleared
+    void run(record_reader& reader, record_process& proc, const sink_t& sink,
+             const std::atomic<int>& running, const idle_t& idle = idle_t());
+
+    void print_stats(std::ostream& os) const;
+
+private:
+    void capture(record_reader& reader, const std::atomic<int>& running);
+    void decode(record_process& proc);
+
+    const thread_options options_;
+    record_profile* const profile_;
+    std::vector<std::unique_ptr<record_batch>> batches_;
+    spsc_ring<size_t> free_;
+    spsc_ring<size_t> decode_;
+    spsc_ring<size_t> write_;
+    std::atomic<bool> capture_done_;
+    std::atomic<bool> decode_done_;
+    std::atomic<bool> stop_;
+    size_t capture_waits_;
+};
@@ -1,9 +1,11 @@
 #include "record_process.hpp"
+#include "record_batch.hpp"
 #include "crc32.hpp"
 #include <netinet/ether.h>
 #include <netinet/ip.h>
 #include <pcap.h>
-#include <math.h>
+#include <string.h>
+#include <atomic>
 #include <limits>
 #include <iostream>
 
@@ -91,6 +93,7 @@ const char* record_time_t::status_str() const
     case record_time_zero:          return "record_time_zero";
     case record_time_missing:       return "record_time_missing";
     case missing_recent_keyframe:   return "missing_recent_keyframe";
+    case unknown_format:            return "unknown_format";
     default:
         return "unknown";
     }
@@ -99,53 +102,138 @@ const char* record_time_t::status_str() const
 record_process::record_process(const process_options& opt)
 : options_(opt)
 , keyframe_()
+, tick_ns_(keyframe_.freq)
 , time_offset_end_(opt.time_offset_end)
 , timestamp_format_(opt.timestamp_format)
-{}
+, kernel_(&record_process::process_generic)
+, kernel_name_("generic")
+{
+    if (detected())
+        select_kernel();
+}
+
+void record_process::seed(const keyframe_data& data)
+{
+    keyframe_ = data;
+    if (tick_ns_.freq != keyframe_.freq)
+        tick_ns_ = tick_converter(keyframe_.freq);
+    if (detected())
+        select_kernel();
+}
+
+bool record_process::detected() const
+{
+    return timestamp_format_ != process_options::timestamp_format_auto && time_offset_end_ != -1;
+}
+
+process_options record_process::detected_options() const
+{
+    process_options opt = options_;
+    opt.timestamp_format = timestamp_format_;
+    opt.time_offset_end = time_offset_end_;
+    return opt;
+}
 
 record_time_t record_process::process_keyframe(const keyframe_data& data)
 {
+    // the 32 bit kernels depend on the tick layout of the keyframe
+    const bool reselect = !keyframe_.utc_nanos || keyframe_.arista_compat != data.arista_compat;
     keyframe_ = data;
+    if (tick_ns_.freq != keyframe_.freq)
+        tick_ns_ = tick_converter(keyframe_.freq);
+    if (reselect && detected())
+        select_kernel();
     record_time_t result(record_time_t::ok);
     result.is_keyframe = true;
     result.hw_time = ns_to_pstime(data.utc_nanos);
     return result;
 }
 
-record_time_t record_process::process_exa_keyframe(const read_record_t& record, const char* keyframe, size_t len)
+int record_process::parse_exa_keyframe(const read_record_t& record, const char* keyframe, size_t len,
+                                       keyframe_data& data)
 {
     const exa_keyframe* kf = reinterpret_cast<const exa_keyframe*>(keyframe);
     // TODO: check that we have magic in correct endian
     if (!(kf->version == 1 && kf->magic == exa_keyframe::kf_magic) && !(kf->version == 0 && kf->magic == 1))
-        return record_time_t(record_time_t::unsupported_keyframe);
+        return record_time_t::unsupported_keyframe;
 
-    keyframe_data data;
     data.utc_nanos = ntohll(kf->utc);
     data.clock_time = record.clock_time;
     data.counter = ntohll(kf->counter);
     data.freq = ntohll(kf->freq);
-    return process_keyframe(data);
+    return record_time_t::ok;
 }
 
-record_time_t record_process::process_compat_keyframe(const read_record_t& record, const char* keyframe, size_t len)
+int record_process::parse_compat_keyframe(const read_record_t& record, const char* keyframe, size_t len,
+                                          keyframe_data& data)
 {
     const compat_keyframe* kf = reinterpret_cast<const compat_keyframe*>(keyframe);
     if (ntohll(kf->skew_num) != 1 || ntohll(kf->skew_denom) != 1)
-        return record_time_t(record_time_t::unsupported_keyframe);
+        return record_time_t::unsupported_keyframe;
 
-    keyframe_data data;
     data.utc_nanos = ntohll(kf->utc);
     data.clock_time = record.clock_time;
     data.counter = ntohll(kf->asic_time);
     data.arista_compat = true;
-    return process_keyframe(data);
+    return record_time_t::ok;
 }
 
+int record_process::find_keyframe(const read_record_t& record, keyframe_data& data)
+{
+    const char* ptr = record.data;
+    const char* end = record.data + record.len_capture;
 
-int64_t record_process::ticks_since_last_keyframe(const uint32_t* hw_time)
+    const eth_header_t* eth = reinterpret_cast<const eth_header_t*>(ptr);
+    const uint32_t eth_type = ntohs(eth->ether_type);
+    ptr += sizeof(eth_header_t);
+
+    if (eth_type == exa_keyframe::kf_ether_type)
+    {
+        if (parse_exa_keyframe(record, ptr, end - ptr, data) == record_time_t::ok)
+            return record_time_t::ok;
+        // else fall through and try get the timestamp from the
+        // unrecognised packet
+    }
+    else if (eth_type == 0x0800 && *ptr == 0x45)
+    {
+        const uint32_t len_eth_ip = sizeof(eth_header_t) + sizeof(ip_header_t);
+        if (record.len_capture < len_eth_ip)
+            return record_time_t::record_too_short;
+
+        const ip_header_t* ip = reinterpret_cast<const ip_header_t*>(ptr);
+        const uint32_t ip_len = ntohs(ip->ip_len);
+        ptr += sizeof(ip_header_t);
+
+        if (ip->ip_p == compat_keyframe::ckf_proto
+            && ip->ip_ttl == IPDEFTTL
+            && ip->ip_dst.s_addr == compat_keyframe::ckf_dest
+            && ip->ip_src.s_addr == compat_keyframe::ckf_src )
+        {
+            uint32_t len = ip_len - sizeof(ip_header_t);
+            if (len == sizeof(exa_keyframe))
+                return parse_exa_keyframe(record, ptr, end-ptr, data);
+            else if (len == sizeof(compat_keyframe))
+                return parse_compat_keyframe(record, ptr, end-ptr, data);
+            // else treat as normal ip packet
+        }
+    }
+    return record_time_t::unspecified;
+}
+
+bool record_process::is_keyframe(const read_record_t& record)
+{
+    if (record.linktype != DLT_EN10MB || record.len_capture < sizeof(eth_header_t)
+        || record.len_capture != record.len_orig)
+        return false;
+    keyframe_data data;
+    return find_keyframe(record, data) == record_time_t::ok;
+}
+
+template <bool arista_compat>
+int64_t record_process::ticks_since_last_keyframe(const uint32_t* hw_time) const
 {
     int64_t ticks = ntohl(*hw_time);
-    if (keyframe_.arista_compat)
+    if (arista_compat)
     {
         ticks = ((ticks & ~0xff) >> 1) + (ticks & 0x7f);
         ticks -= (keyframe_.counter & 0x7fffffff);
@@ -163,7 +251,15 @@ int64_t record_process::ticks_since_last_keyframe(const uint32_t* hw_time)
     return ticks;
 }
 
-record_time_t record_process::process_32bit_timestamps(const read_record_t& record, char* buffer)
+int64_t record_process::ticks_since_last_keyframe(const uint32_t* hw_time)
+{
+    if (keyframe_.arista_compat)
+        return ticks_since_last_keyframe<true>(hw_time);
+    else
+        return ticks_since_last_keyframe<false>(hw_time);
+}
+
+record_time_t record_process::process_32bit_timestamps(read_record_t& record, char* buffer, size_t buffer_len)
 {
     // only deal with ethernet frames
     if (record.linktype != DLT_EN10MB)
@@ -177,46 +273,15 @@ record_time_t record_process::process_32bit_timestamps(const read_record_t& reco
     if (record.len_capture != record.len_orig)
         return record_time_t(record_time_t::record_truncated);
 
-    char* ptr = buffer;
-    char* end = buffer + record.len_capture;
-
-    const eth_header_t* eth = reinterpret_cast<const eth_header_t*>(ptr);
-    const uint32_t eth_type = ntohs(eth->ether_type);
-    ptr += sizeof(eth_header_t);
-
-    if (eth_type == exa_keyframe::kf_ether_type)
-    {
-        const record_time_t ret = process_exa_keyframe(record, ptr, end - ptr);
-        if (ret.status != record_time_t::unsupported_keyframe)
-            return ret;
-        // else fall through and try get the timestamp from the
-        // unrecognised packet
-    }
-    else if (eth_type == 0x0800 && *ptr == 0x45)
-    {
-        const uint32_t len_eth_ip = sizeof(eth_header_t) + sizeof(ip_header_t);
-        if (record.len_capture < len_eth_ip)
-            return record_time_t(record_time_t::record_too_short);
-
-        const ip_header_t* ip = reinterpret_cast<const ip_header_t*>(ptr);
-        const uint32_t ip_len = ntohs(ip->ip_len);
-        ptr += sizeof(ip_header_t);
-
-        if (ip->ip_p == compat_keyframe::ckf_proto
-            && ip->ip_ttl == IPDEFTTL
-            && ip->ip_dst.s_addr == compat_keyframe::ckf_dest
-            && ip->ip_src.s_addr == compat_keyframe::ckf_src )
-        {
-            uint32_t len = ip_len - sizeof(ip_header_t);
-            if (len == sizeof(exa_keyframe))
-                return process_exa_keyframe(record, ptr, end-ptr);
-            else if (len == sizeof(compat_keyframe))
-                return process_compat_keyframe(record, ptr, end-ptr);
-            // else treat as normal ip packet
-        }
-    }
+    keyframe_data data;
+    const int keyframe = find_keyframe(record, data);
+    if (keyframe == record_time_t::ok)
+        return process_keyframe(data);
+    else if (keyframe != record_time_t::unspecified)
+        return record_time_t(keyframe);
 
     // fallen through, so not a (recognised) keyframe
+    const char* end = record.data + record.len_capture;
 
     pstime_t time_since_last_keyframe = record.clock_time - keyframe_.clock_time;
     // keyframes published every second, allow for some missing
@@ -229,13 +294,13 @@ record_time_t record_process::process_32bit_timestamps(const read_record_t& reco
     if (time_offset_end_ == -1)
     {
         // heuristics to find the timestamp offset
-        bool crc_valid = (crc32(0, buffer, end - buffer) == 0x2144DF1C);
+        bool crc_valid = (crc32(0, record.data, record.len_capture) == 0x2144DF1C);
 
         int64_t ticks4 = ticks_since_last_keyframe(reinterpret_cast<const uint32_t*>(end - 4));
         int64_t ticks8 = ticks_since_last_keyframe(reinterpret_cast<const uint32_t*>(end - 8));
 
-        int64_t diff4 = ticks4 * 1000000000 / keyframe_.freq - time_since_last_keyframe.ns();
-        int64_t diff8 = ticks8 * 1000000000 / keyframe_.freq - time_since_last_keyframe.ns();
+        int64_t diff4 = int64_t(tick_ns_.ns(ticks4)) - time_since_last_keyframe.ns();
+        int64_t diff8 = int64_t(tick_ns_.ns(ticks8)) - time_since_last_keyframe.ns();
 
         const int64_t max_diff = 10000000;
 
@@ -265,21 +330,27 @@ record_time_t record_process::process_32bit_timestamps(const read_record_t& reco
     record_time_t result(record_time_t::ok);
 
     int64_t ticks = ticks_since_last_keyframe(reinterpret_cast<const uint32_t*>(end - time_offset_end_));
-    int64_t delta_ns = ticks * 1000000000 / keyframe_.freq;
+    uint64_t delta_ns = tick_ns_.ns(ticks);
     result.hw_time = ns_to_pstime(keyframe_.utc_nanos + delta_ns);
 
-    if (time_offset_end_ == 4 && options_.fix_fcs)
+    if (time_offset_end_ == 4 && options_.fix_fcs && record.len_capture <= buffer_len)
     {
-        // overwrite timestamp with recalculated FCS
-        uint32_t* packet_fcs = reinterpret_cast<uint32_t*>(end - 4);
-        *packet_fcs = crc32(0, buffer, end - buffer - 4);
+        // overwrite timestamp with recalculated FCS, copying the record
+        // into the scratch buffer first if it is not already there
+        if (record.data != buffer)
+        {
+            memcpy(buffer, record.data, record.len_capture);
+            record.data = buffer;
+        }
+        uint32_t* packet_fcs = reinterpret_cast<uint32_t*>(buffer + record.len_capture - 4);
+        *packet_fcs = crc32(0, buffer, record.len_capture - 4);
         result.fixed_fcs = true;
     }
 
     return result;
 }
 
-record_time_t record_process::process_trailer_timestamps(const read_record_t& record, char* buffer)
+record_time_t record_process::process_trailer_timestamps(read_record_t& record, char* buffer, size_t buffer_len)
 {
     // only deal with ethernet frames
     if (record.linktype != DLT_EN10MB)
@@ -293,8 +364,8 @@ record_time_t record_process::process_trailer_timestamps(const read_record_t& re
     if (record.len_capture != record.len_orig)
         return record_time_t(record_time_t::record_truncated);
 
-    char* ptr = buffer;
-    char* end = buffer + record.len_capture;
+    const char* ptr = record.data;
+    const char* end = record.data + record.len_capture;
 
     if (time_offset_end_ == -1)
     {
@@ -343,43 +414,190 @@ record_time_t record_process::process_trailer_timestamps(const read_record_t& re
         reinterpret_cast<const exablaze_timestamp_trailer*>(end - time_offset_end_);
 
     uint32_t seconds_since_epoch = ntohl(trailer->seconds_since_epoch);
-    double frac_seconds = ldexp((uint64_t(trailer->frac_seconds[0]) << 32) |
+    uint64_t frac_seconds = (uint64_t(trailer->frac_seconds[0]) << 32) |
         (uint64_t(trailer->frac_seconds[1]) << 24) | (uint64_t(trailer->frac_seconds[2]) << 16) |
-        (uint64_t(trailer->frac_seconds[3]) << 8) | uint64_t(trailer->frac_seconds[4]), -40);
+        (uint64_t(trailer->frac_seconds[3]) << 8) | uint64_t(trailer->frac_seconds[4]);
 
     record_time_t result(record_time_t::ok);
-    result.hw_time = pstime_t(seconds_since_epoch, frac_seconds * 1000000000000ULL);
+    result.hw_time = pstime_t(seconds_since_epoch, frac40_to_psec(frac_seconds));
     result.device_id = trailer->device_id;
     result.port = trailer->port;
 
     return result;
 }
 
-record_time_t record_process::process(const read_record_t& record, char* buffer)
+template <int offset_end, bool arista_compat, bool fix_fcs>
+record_time_t record_process::process_32bit_kernel(read_record_t& record, char* buffer, size_t buffer_len)
 {
+    if (record.linktype != DLT_EN10MB)
+        return record_time_t(record_time_t::unsupported_linktype);
+    if (record.len_capture < sizeof(eth_header_t))
+        return record_time_t(record_time_t::record_too_short);
+    if (record.len_capture != record.len_orig)
+        return record_time_t(record_time_t::record_truncated);
+
+    keyframe_data data;
+    const int keyframe = find_keyframe(record, data);
+    if (keyframe == record_time_t::ok)
+        return process_keyframe(data);
+    else if (keyframe != record_time_t::unspecified)
+        return record_time_t(keyframe);
+
+    if (record.clock_time - keyframe_.clock_time > pstime_t(5, 0))
+        return record_time_t(record_time_t::missing_recent_keyframe);
+
+    const char* end = record.data + record.len_capture;
+    record_time_t result(record_time_t::ok);
+    int64_t ticks = ticks_since_last_keyframe<arista_compat>(reinterpret_cast<const uint32_t*>(end - offset_end));
+    uint64_t delta_ns = tick_ns_.ns(ticks);
+    result.hw_time = ns_to_pstime(keyframe_.utc_nanos + delta_ns);
+
+    if (fix_fcs && record.len_capture <= buffer_len)
+    {
+        if (record.data != buffer)
+        {
+            memcpy(buffer, record.data, record.len_capture);
+            record.data = buffer;
+        }
+        uint32_t* packet_fcs = reinterpret_cast<uint32_t*>(buffer + record.len_capture - 4);
+        *packet_fcs = crc32(0, buffer, record.len_capture - 4);
+        result.fixed_fcs = true;
+    }
+    return result;
+}
+
+template <int offset_end>
+record_time_t record_process::process_trailer_kernel(read_record_t& record, char* buffer, size_t buffer_len)
+{
+    if (record.linktype != DLT_EN10MB)
+        return record_time_t(record_time_t::unsupported_linktype);
+    if (record.len_capture < offset_end)
+        return record_time_t(record_time_t::record_too_short);
+    if (record.len_capture != record.len_orig)
+        return record_time_t(record_time_t::record_truncated);
+
+    const exablaze_timestamp_trailer* trailer =
+        reinterpret_cast<const exablaze_timestamp_trailer*>(record.data + record.len_capture - offset_end);
+
+    uint32_t seconds_since_epoch = ntohl(trailer->seconds_since_epoch);
+    uint64_t frac_seconds = (uint64_t(trailer->frac_seconds[0]) << 32) |
+        (uint64_t(trailer->frac_seconds[1]) << 24) | (uint64_t(trailer->frac_seconds[2]) << 16) |
+        (uint64_t(trailer->frac_seconds[3]) << 8) | uint64_t(trailer->frac_seconds[4]);
+
+    record_time_t result(record_time_t::ok);
+    result.hw_time = pstime_t(seconds_since_epoch, frac40_to_psec(frac_seconds));
+    result.device_id = trailer->device_id;
+    result.port = trailer->port;
+    return result;
+}
+
+void record_process::select_kernel()
+{
+    // last kernel announced by any processor, so parallel decoders do not
+    // each announce the same one
+    static std::atomic<const char*> announced(nullptr);
+
+    const char* name = nullptr;
+    if (timestamp_format_ == process_options::timestamp_format_32bit)
+    {
+        const bool compat = keyframe_.arista_compat;
+        // an unusual offset keeps the unspecialised decoder
+        name = "32bit-any-offset";
+        kernel_ = &record_process::process_32bit_timestamps;
+        if (time_offset_end_ == 4 && options_.fix_fcs)
+        {
+            // timestamp in place of the fcs, which is recalculated
+            name = compat ? "32bit-fcs-replace-arista-fix-fcs" : "32bit-fcs-replace-exa-fix-fcs";
+            kernel_ = compat ? &record_process::process_32bit_kernel<4, true, true>
+                             : &record_process::process_32bit_kernel<4, false, true>;
+        }
+        else if (time_offset_end_ == 4)
+        {
+            name = compat ? "32bit-fcs-replace-arista" : "32bit-fcs-replace-exa";
+            kernel_ = compat ? &record_process::process_32bit_kernel<4, true, false>
+                             : &record_process::process_32bit_kernel<4, false, false>;
+        }
+        else if (time_offset_end_ == 8)
+        {
+            // timestamp appended before the fcs
+            name = compat ? "32bit-append-arista" : "32bit-append-exa";
+            kernel_ = compat ? &record_process::process_32bit_kernel<8, true, false>
+                             : &record_process::process_32bit_kernel<8, false, false>;
+        }
+    }
+    else if (timestamp_format_ == process_options::timestamp_format_trailer)
+    {
+        name = "trailer-any-offset";
+        kernel_ = &record_process::process_trailer_timestamps;
+        if (time_offset_end_ == sizeof(exablaze_timestamp_trailer))
+        {
+            name = "trailer-16";
+            kernel_ = &record_process::process_trailer_kernel<sizeof(exablaze_timestamp_trailer)>;
+        }
+        else if (time_offset_end_ == sizeof(exablaze_timestamp_trailer) + 4)
+        {
+            // trailer followed by an fcs
+            name = "trailer-20";
+            kernel_ = &record_process::process_trailer_kernel<sizeof(exablaze_timestamp_trailer) + 4>;
+        }
+    }
+
+    // until a keyframe is seen the tick layout of a 32 bit kernel is a guess
+    const bool settled = timestamp_format_ != process_options::timestamp_format_32bit
+        || keyframe_.utc_nanos;
+    if (!name)
+        return;
+    kernel_name_ = name;
+    if (settled && options_.verbose && announced.exchange(name) != name)
+        std::cout << "Using " << name << " decode kernel" << std::endl;
+}
+
+record_time_t record_process::process_generic(read_record_t& record, char* buffer, size_t buffer_len)
+{
+    record_time_t result;
     switch (timestamp_format_)
     {
     case process_options::timestamp_format_32bit:
-        return process_32bit_timestamps(record, buffer);
+        result = process_32bit_timestamps(record, buffer, buffer_len);
+        break;
     case process_options::timestamp_format_trailer:
-        return process_trailer_timestamps(record, buffer);
+        result = process_trailer_timestamps(record, buffer, buffer_len);
+        break;
     default:
+        // look for exablaze timestamp trailer
+        result = process_trailer_timestamps(record, buffer, buffer_len);
+        if (result.status == record_time_t::ok)
+            timestamp_format_ = process_options::timestamp_format_trailer;
+        else
         {
-            // look for exablaze timestamp trailer
-            record_time_t result = process_trailer_timestamps(record, buffer);
+            // if trailer not found, parse as 32 bit timestamp
+            result = process_32bit_timestamps(record, buffer, buffer_len);
             if (result.status == record_time_t::ok)
-            {
-                timestamp_format_ = process_options::timestamp_format_trailer;
-                return result;
-            }
-            else
-            {
-                // if trailer not found, parse as 32 bit timestamp
-                result = process_32bit_timestamps(record, buffer);
-                if (result.status == record_time_t::ok)
-                    timestamp_format_ = process_options::timestamp_format_32bit;
-                return result;
-            }
+                timestamp_format_ = process_options::timestamp_format_32bit;
         }
     }
+
+    // detection has settled, switch to the kernel for the format
+    if (detected())
+        select_kernel();
+    return result;
+}
+
+record_time_t record_process::process(read_record_t& record, char* buffer, size_t buffer_len)
+{
+    return (this->*kernel_)(record, buffer, buffer_len);
+}
+
+size_t record_process::process_batch(record_batch& batch)
+{
+    for (size_t i = 0; i < batch.size; ++i)
+    {
+        read_record_t& record = batch.records[i];
+        if (record.status != read_record_t::ok)
+            return i;
+        batch.times[i] = process(record, batch.slot(i), batch.slot_len);
+        if (batch.times[i].status < 0)
+            return i + 1;
+    }
+    return batch.size;
 }
@@ -4,6 +4,8 @@
 #include "options.hpp"
 #include "pstime.hpp"
 
+struct record_batch;
+
 struct record_time_t
 {
     // negative status are unrecoverable
@@ -43,7 +45,14 @@ struct record_time_t
 
 struct record_process
 {
-private:
+    // bytes at the start and end of a record that decoding reads, enough
+    // for the headers of any keyframe and for any timestamp trailer; a
+    // record read sparsely with these is decoded the same, but its fcs
+    // cannot be fixed
+    static const uint32_t decode_head_len = 128;
+    static const uint32_t decode_tail_len = 32;
+
+    // decoder state taken from the most recent keyframe
     struct keyframe_data
     {
         uint64_t utc_nanos;
@@ -61,24 +70,79 @@ private:
         {}
     };
 
+private:
+    // decodes one record, specialised for a timestamp format and mode
+    typedef record_time_t (record_process::*kernel_fn)(read_record_t& record, char* buffer, size_t buffer_len);
+
     const process_options options_;
     keyframe_data keyframe_;
+    // nanoseconds from ticks at the keyframe frequency
+    tick_converter tick_ns_;
     int time_offset_end_;
     int timestamp_format_;
+    kernel_fn kernel_;
+    const char* kernel_name_;
 
 public:
     record_process(const process_options& opt);
 
-    record_time_t process(const read_record_t& record, char* buffer);
+    // buffer of buffer_len bytes is used as scratch space when the record
+    // has to be modified, record.data is then redirected to it; a record
+    // longer than the buffer is left unmodified
+    record_time_t process(read_record_t& record, char* buffer, size_t buffer_len);
+
+    // true once the timestamp format and offset are known
+    bool detected() const;
+
+    // options for decoding the rest of the stream with the detected format
+    // and offset, so another processor decodes it identically
+    process_options detected_options() const;
+
+    // true if the record is a keyframe that decoding would apply
+    static bool is_keyframe(const read_record_t& record);
+
+    // state from the last keyframe applied
+    const keyframe_data& keyframe() const { return keyframe_; }
+
+    // continue as if the keyframe had just been processed, for decoding
+    // from the middle of a capture with state kept elsewhere
+    void seed(const keyframe_data& data);
+
+    // name of the decode kernel in use, "generic" until the format is known
+    const char* kernel_name() const { return kernel_name_; }
+
+    // decode the batch into batch.times, stopping at the first record not
+    // read ok or after an unrecoverable error; returns the number decoded
+    size_t process_batch(record_batch& batch);
 
 private:
     int64_t ticks_since_last_keyframe(const uint32_t* hw_time);
+    template <bool arista_compat>
+    int64_t ticks_since_last_keyframe(const uint32_t* hw_time) const;
 
     record_time_t process_keyframe(const keyframe_data& data);
-    record_time_t process_exa_keyframe(const read_record_t& record, const char* keyframe, size_t len);
-    record_time_t process_compat_keyframe(const read_record_t& record, const char* keyframe, size_t len);
 
-    record_time_t process_32bit_timestamps(const read_record_t& record, char* buffer);
-    record_time_t process_trailer_timestamps(const read_record_t& record, char* buffer);
+    static int parse_exa_keyframe(const read_record_t& record, const char* keyframe, size_t len,
+                                  keyframe_data& data);
+    static int parse_compat_keyframe(const read_record_t& record, const char* keyframe, size_t len,
+                                     keyframe_data& data);
+    // ok with data filled in for a supported keyframe, unspecified if the
+    // record is not a keyframe, otherwise the status to fail the record with
+    static int find_keyframe(const read_record_t& record, keyframe_data& data);
+
+    record_time_t process_32bit_timestamps(read_record_t& record, char* buffer, size_t buffer_len);
+    record_time_t process_trailer_timestamps(read_record_t& record, char* buffer, size_t buffer_len);
+
+    // detects the format and offset, then switches to a specialised kernel
+    record_time_t process_generic(read_record_t& record, char* buffer, size_t buffer_len);
+
+    // kernels for a known format with every mode a template parameter
+    template <int offset_end, bool arista_compat, bool fix_fcs>
+    record_time_t process_32bit_kernel(read_record_t& record, char* buffer, size_t buffer_len);
+    template <int offset_end>
+    record_time_t process_trailer_kernel(read_record_t& record, char* buffer, size_t buffer_len);
+
+    // kernel for the detected format, mode and current keyframe
+    void select_kernel();
 };
 
@@ -0,0 +1,193 @@
+#include "record_profile.hpp"
+#include "record_batch.hpp"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_TSC
+#endif
+
+uint64_t profile_ticks()
+{
+#ifdef PROFILE_TSC
+    // rdtscp waits for the stage before it to finish
+    unsigned aux;
+    return __rdtscp(&aux);
+#else
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static const char* const stage_names[] = { "read", "decode", "write" };
+
+record_profile::record_profile(std::ostream& os, unsigned interval_s)
+: os_(os)
+, start_()
+, lock_()
+, changed_()
+, stop_(false)
+, thread_()
+{
+    start_ = take();
+    if (interval_s)
+        thread_ = std::thread(&record_profile::report_thread, this, interval_s);
+}
+
+record_profile::~record_profile()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    changed_.notify_all();
+    if (thread_.joinable())
+        thread_.join();
+}
+
+size_t record_profile::bucket(uint64_t ticks)
+{
+    if (ticks < sub_buckets)
+        return ticks;
+    // sub_buckets linear steps between each power of two
+    const unsigned msb = 63 - __builtin_clzll(ticks);
+    return (msb - sub_bits + 1) * sub_buckets + ((ticks >> (msb - sub_bits)) & (sub_buckets - 1));
+}
+
+uint64_t record_profile::bucket_value(size_t bucket)
+{
+    if (bucket < sub_buckets)
+        return bucket;
+    const unsigned msb = bucket / sub_buckets + sub_bits - 1;
+    return (sub_buckets + bucket % sub_buckets) << (msb - sub_bits);
+}
+
+uint64_t record_profile::add(stage_t stage, uint64_t start, const record_batch& batch, size_t count)
+{
+    const uint64_t now = profile_ticks();
+    // polling a source with nothing to read is not a cost of any record
+    if (!count)
+        return now;
+
+    histogram& h = stages_[stage];
+    const uint64_t ticks = now - start;
+    h.counts[bucket(ticks / count)].fetch_add(count, std::memory_order_relaxed);
+    h.batches.fetch_add(1, std::memory_order_relaxed);
+    h.records.fetch_add(count, std::memory_order_relaxed);
+    h.ticks.fetch_add(ticks, std::memory_order_relaxed);
+    if (stage == read)
+    {
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (batch.records[i].status != read_record_t::ok)
+                continue;
+            ++packets;
+            bytes += batch.records[i].len_capture;
+        }
+        h.packets.fetch_add(packets, std::memory_order_relaxed);
+        h.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    return now;
+}
+
+record_profile::snapshot record_profile::take() const
+{
+    snapshot s;
+    for (size_t i = 0; i < stages; ++i)
+    {
+        const histogram& h = stages_[i];
+        snapshot::stage& out = s.stages[i];
+        for (size_t b = 0; b < buckets; ++b)
+            out.counts[b] = h.counts[b].load(std::memory_order_relaxed);
+        out.batches = h.batches.load(std::memory_order_relaxed);
+        out.records = h.records.load(std::memory_order_relaxed);
+        out.packets = h.packets.load(std::memory_order_relaxed);
+        out.bytes = h.bytes.load(std::memory_order_relaxed);
+        out.ticks = h.ticks.load(std::memory_order_relaxed);
+    }
+    s.time = std::chrono::steady_clock::now();
+    s.ticks = profile_ticks();
+    return s;
+}
+
+void record_profile::print(std::ostream& os) const
+{
+    print(os, start_, take(), "run");
+}
+
+void record_profile::print(std::ostream& os, const snapshot& from, const snapshot& to,
+                           const char* period) const
+{
+    const double seconds = std::chrono::duration<double>(to.time - from.time).count();
+    if (seconds <= 0)
+        return;
+    // the counter rate is measured against the clock over the whole run
+    const double ticks_per_s = (to.ticks - start_.ticks)
+                             / std::chrono::duration<double>(to.time - start_.time).count();
+
+    const snapshot::stage& in = to.stages[read];
+    const snapshot::stage& in_from = from.stages[read];
+    const uint64_t packets = in.packets - in_from.packets;
+    const uint64_t bytes = in.bytes - in_from.bytes;
+    const std::ios_base::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(2)
+       << "Profile " << period << ": " << seconds << "s, packets " << packets
+       << " (" << uint64_t(packets / seconds) << "/s), bytes " << bytes
+       << " (" << bytes / seconds / 1e6 << " MB/s)"
+#ifdef PROFILE_TSC
+       << ", cycles at " << ticks_per_s / 1e9 << " GHz"
+#endif
+       << std::endl;
+
+    for (size_t i = 0; i < stages; ++i)
+    {
+        const snapshot::stage& s = to.stages[i];
+        const snapshot::stage& s_from = from.stages[i];
+        const uint64_t n = s.records - s_from.records;
+        if (!n)
+            continue;
+
+        // smallest value with at least the fraction of records at or below it
+        std::vector<double> quantiles = { 0, 0.5, 0.99, 0.999, 1 };
+        std::vector<uint64_t> values;
+        uint64_t seen = 0;
+        size_t b = 0;
+        for (double q : quantiles)
+        {
+            const uint64_t rank = std::max<uint64_t>(1, std::ceil(q * n));
+            for (; b < buckets && seen + s.counts[b] - s_from.counts[b] < rank; ++b)
+                seen += s.counts[b] - s_from.counts[b];
+            values.push_back(bucket_value(b));
+        }
+
+        const double busy = (s.ticks - s_from.ticks) / ticks_per_s;
+        os << "Profile " << stage_names[i] << ": "
+#ifdef PROFILE_TSC
+           << "cycles"
+#else
+           << "ns"
+#endif
+           << " per record min " << values[0] << ", median " << values[1]
+           << ", p99 " << values[2] << ", p99.9 " << values[3] << ", max " << values[4]
+           << "; busy " << busy << "s (" << 100 * busy / seconds << "%), batches "
+           << s.batches - s_from.batches << std::endl;
+    }
+    os.flags(flags);
+}
+
+void record_profile::report_thread(unsigned interval_s)
+{
+    snapshot last = start_;
+    std::unique_lock<std::mutex> guard(lock_);
+    while (!changed_.wait_for(guard, std::chrono::seconds(interval_s), [this] { return stop_; }))
+    {
+        snapshot now = take();
+        print(os_, last, now, "interval");
+        last = std::move(now);
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+struct record_batch;
+
+// the time stamp counter where there is one, otherwise a monotonic clock in ns
+uint64_t profile_ticks();
+
+/*
+ * Costs of the read, decode and write stages, to find where throughput goes
+ * on a production run without attaching a profiler. Each stage of a batch
+ * is timed as a whole and its ticks per record added to a log linear
+ * histogram, so profiling costs two counter reads per stage of a batch.
+ * The histograms are counted with relaxed atomics, so any number of threads
+ * may time a stage while reports are taken. Percentiles are rounded down to
+ * within 1/16 of the true value, and busy time is summed over the threads
+ * running a stage, so it exceeds the run time with --jobs.
+ */
+struct record_profile
+{
+    enum stage_t
+    {
+        read,
+        decode,
+        write,
+        stages
+    };
+
+    // reports the interval just gone to os every interval_s seconds,
+    // unless it is zero
+    record_profile(std::ostream& os, unsigned interval_s);
+    ~record_profile();
+
+    record_profile(const record_profile&) = delete;
+    void operator=(const record_profile&) = delete;
+
+    // the first count records of batch were taken through the stage since
+    // start; returns the ticks now, which the next stage starts from
+    uint64_t add(stage_t stage, uint64_t start, const record_batch& batch, size_t count);
+
+    // reports the whole run so far
+    void print(std::ostream& os) const;
+
+private:
+    static const unsigned sub_bits = 4;
+    static const size_t sub_buckets = 1 << sub_bits;
+    static const size_t buckets = (64 - sub_bits + 1) * sub_buckets;
+
+    struct histogram
+    {
+        std::vector<std::atomic<uint64_t>> counts = std::vector<std::atomic<uint64_t>>(buckets);
+        std::atomic<uint64_t> batches{0};
+        std::atomic<uint64_t> records{0};
+        // read records that were packets, not the end of the input or an error
+        std::atomic<uint64_t> packets{0};
+        std::atomic<uint64_t> bytes{0};
+        std::atomic<uint64_t> ticks{0};
+    };
+
+    struct snapshot
+    {
+        struct stage
+        {
+            std::vector<uint64_t> counts = std::vector<uint64_t>(buckets);
+            uint64_t batches = 0;
+            uint64_t records = 0;
+            uint64_t packets = 0;
+            uint64_t bytes = 0;
+            uint64_t ticks = 0;
+        };
+
+        stage stages[record_profile::stages];
+        std::chrono::steady_clock::time_point time = std::chrono::steady_clock::time_point();
+        uint64_t ticks = 0;
+    };
+
+    static size_t bucket(uint64_t ticks);
+    static uint64_t bucket_value(size_t bucket);
+
+    snapshot take() const;
+    void print(std::ostream& os, const snapshot& from, const snapshot& to, const char* period) const;
+    void report_thread(unsigned interval_s);
+
+    std::ostream& os_;
+    histogram stages_[stages];
+    snapshot start_;
+    std::mutex lock_;
+    std::condition_variable changed_;
+    bool stop_;
+    std::thread thread_;
+};
+
+// times the stages of a batch in turn when profiling, otherwise does nothing
+struct stage_timer
+{
+    explicit stage_timer(record_profile* profile)
+    : profile_(profile)
+    , start_(profile ? profile_ticks() : 0)
+    {}
+
+    void done(record_profile::stage_t stage, const record_batch& batch, size_t count)
+    {
+        if (profile_)
+            start_ = profile_->add(stage, start_, batch, count);
+    }
+
+private:
+    record_profile* profile_;
+    uint64_t start_;
+};
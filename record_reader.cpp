@@ -1,9 +1,18 @@
 #include "record_reader.hpp"
+#include "record_batch.hpp"
+#include "record_index.hpp"
 #include "pcap_common.hpp"
+#include "decompress_buf.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <stdexcept>
 #include <iostream>
-#include <fstream>
-#ifdef WITH_EXANIC
+#include <istream>
+#include <unordered_map>
+#ifdef WITH_EXANIC_EMULATOR
+#include "exanic_emulator.hpp"
+#elif defined(WITH_EXANIC)
 #include <exanic/exanic.h>
 #include <exanic/config.h>
 #include <exanic/fifo_rx.h>
@@ -11,56 +20,106 @@
 #include <exanic/time.h>
 #endif
 #include <string.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
 #include <net/if.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 
-struct pcap_record_reader : public record_reader
+static bool pcap_file_header_nanos(const pcap_file_header_t& header)
+{
+    if (header.version_major != 2 || header.version_minor != 4)
+        throw std::invalid_argument(std::string("unsupported pcap version"));
+    
+    if (header.linktype != DLT_EN10MB)
+        throw std::invalid_argument(std::string("unsupported pcap linktype"));
+    
+    if (header.magic == pcap_magic_t::nanos_magic)
+        return true;
+    else if (header.magic != pcap_magic_t::micro_magic)
+        throw std::invalid_argument(std::string("unsupported pcap architecture"));
+    return false;
+}
+
+static read_record_t pcap_record(const pcap_header_t& header, bool nanos)
+{
+    read_record_t record;
+    record.linktype = DLT_EN10MB;
+    record.len_capture = header.len_capture;
+    record.len_orig = header.len_orig;
+    if (nanos)
+        record.clock_time = pstime_t(header.tv_secs, header.tv_frac * 1000UL, 9);
+    else
+        record.clock_time = pstime_t(header.tv_secs, header.tv_frac * 1000000ULL, 6);
+    record.is_real_time = false;
+    return record;
+}
+
+/*
+ * Streaming reader for pipes, stdin and compressed files, read ahead in
+ * large blocks on a separate thread.
+ */
+struct pcap_record_reader final : public record_reader
 {
-    std::ifstream is;
+    // longest to wait for input before returning to the caller
+    static const unsigned wait_ms = 100;
+
+    std::unique_ptr<decompress_buf> buf;
+    std::istream is;
     bool nanos;
+    // bytes read at each end of a record, 0 to read all of it
+    uint32_t sparse_head;
+    uint32_t sparse_tail;
     
     pcap_record_reader(const std::string& fname)
-    : is(fname.c_str())
+    : buf(new decompress_buf(fname, decompress_buf::format(fname)))
+    , is(buf.get())
     , nanos(false)
+    , sparse_head(0)
+    , sparse_tail(0)
     {
-        if (!is.good())
-            throw std::invalid_argument(std::string("could not open file"));
         pcap_file_header_t header;
         is.read((char*)&header, sizeof(header));
         if (!is.good())
             throw std::invalid_argument(std::string("could not read pcap header"));
-        
-        if (header.version_major != 2 || header.version_minor != 4)
-            throw std::invalid_argument(std::string("unsupported pcap version"));
-        
-        if (header.linktype != DLT_EN10MB)
-            throw std::invalid_argument(std::string("unsupported pcap linktype"));
-        
-        if (header.magic == pcap_magic_t::nanos_magic)
-            nanos = true;
-        else if (header.magic != pcap_magic_t::micro_magic)
-            throw std::invalid_argument(std::string("unsupported pcap architecture"));
-    }
-    
-    virtual ~pcap_record_reader()
-    {
-        is.close();
+        nanos = pcap_file_header_nanos(header);
     }
     
     std::string type() const override
     {
         return "pcap";
     }
+
+    size_t next_batch(record_batch& batch) override
+    {
+        return next_batch_loop(*this, batch);
+    }
+
+    bool sparse(uint32_t head, uint32_t tail) override
+    {
+        sparse_head = head;
+        sparse_tail = tail;
+        return true;
+    }
     
     // for pcap the read is blocking
     read_record_t next(char* buffer, size_t buffer_len) override
     {
-        if (!is.is_open())
-            return read_record_t(read_record_t::eof);
-        // packet_t in host endian format, so can be read directly
+        // a quiet pipe lets the caller check whether to carry on, rather
+        // than blocking part way through a record
         pcap_header_t header;
+        if (!buf->wait_ready(sizeof(header), wait_ms))
+            return read_record_t(read_record_t::again);
+        if (buf->peek(&header, sizeof(header)) && header.len_capture <= buffer_len
+            && !buf->wait_ready(sizeof(header) + header.len_capture, wait_ms))
+            return read_record_t(read_record_t::again);
+        // packet_t in host endian format, so can be read directly
         is.read((char*)&header, sizeof(header));
 
         if (is.eof())
@@ -68,37 +127,525 @@ struct pcap_record_reader : public record_reader
         if (!is.good())
             return read_record_t(read_record_t::error);
         
-        read_record_t record;
-        record.linktype = DLT_EN10MB;
-        record.len_capture = header.len_capture;
-        record.len_orig = header.len_orig;
-        if (nanos)
-            record.clock_time = pstime_t(header.tv_secs, header.tv_frac * 1000UL, 9);
+        read_record_t record = pcap_record(header, nanos);
+        if (record.len_capture > buffer_len)
+            return record;
+        if (sparse_head && record.len_capture > sparse_head + sparse_tail)
+        {
+            // the middle is skipped in the stream buffer, not copied out
+            is.read(buffer, sparse_head);
+            is.ignore(record.len_capture - sparse_head - sparse_tail);
+            is.read(buffer + record.len_capture - sparse_tail, sparse_tail);
+        }
         else
-            record.clock_time = pstime_t(header.tv_secs, header.tv_frac * 1000000ULL, 6);
-        record.is_real_time = false;
-        
-        size_t to_read = (record.len_capture < buffer_len) ? record.len_capture : buffer_len;
-        is.read(buffer, to_read);
+            is.read(buffer, record.len_capture);
+        record.data = buffer;
         if (is.good())
             record.status = read_record_t::ok;
         return record;
     }
 };
 
+/*
+ * Zero copy reader for regular files, records are handed out as pointers
+ * into a read only mapping of the whole file.
+ */
+struct pcap_mmap_reader final : public record_reader
+{
+    // pages behind the read position are dropped in steps of this size,
+    // so resident memory stays bounded for very large captures
+    static const size_t release_step = 64 << 20;
+    // largest record accepted when looking for a record boundary
+    static const uint32_t max_record_len = 0x40000;
+    static const uint32_t min_record_len = 14;
+    // consecutive headers needed to accept a record boundary, and the most
+    // their capture times may step by
+    static const unsigned resync_chain = 8;
+    static const uint32_t max_time_step = 60;
+    // records sampled for their average length when reading sparsely
+    static const size_t sparse_sample = 64;
+
+    int fd;
+    const char* map;
+    size_t map_len;
+    size_t limit;
+    size_t pos;
+    size_t released;
+    bool nanos;
+    uint32_t first_secs;
+    std::unique_ptr<record_index> idx;
+
+    pcap_mmap_reader(const pcap_mmap_reader&) = delete;
+    void operator=(const pcap_mmap_reader&) = delete;
+
+    pcap_mmap_reader(int file, size_t len)
+    : fd(file)
+    , map(nullptr)
+    , map_len(len)
+    , limit(len)
+    , pos(0)
+    , released(0)
+    , nanos(false)
+    , first_secs(0)
+    , idx()
+    {
+        if (map_len < sizeof(pcap_file_header_t))
+        {
+            close(fd);
+            throw std::invalid_argument(std::string("could not read pcap header"));
+        }
+        void* p = mmap(nullptr, map_len, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close(fd);
+            throw std::invalid_argument(std::string("could not map file"));
+        }
+        map = static_cast<const char*>(p);
+        madvise(p, map_len, MADV_SEQUENTIAL);
+
+        pcap_file_header_t header;
+        memcpy(&header, map, sizeof(header));
+        try
+        {
+            nanos = pcap_file_header_nanos(header);
+        }
+        catch (...)
+        {
+            munmap(p, map_len);
+            close(fd);
+            throw;
+        }
+        pos = sizeof(header);
+        if (map_len - pos >= sizeof(pcap_header_t))
+            memcpy(&first_secs, map + pos, sizeof(first_secs));
+    }
+
+    virtual ~pcap_mmap_reader()
+    {
+        munmap(const_cast<char*>(map), map_len);
+        close(fd);
+    }
+
+    std::string type() const override
+    {
+        return "pcap";
+    }
+
+    size_t next_batch(record_batch& batch) override
+    {
+        return next_batch_loop(*this, batch);
+    }
+
+    int64_t tell() const override
+    {
+        return pos;
+    }
+
+    int64_t size() const override
+    {
+        return map_len;
+    }
+
+    bool seek(uint64_t offset, uint64_t end) override
+    {
+        limit = (end && end < map_len) ? end : map_len;
+        pos = (offset < limit) ? offset : limit;
+        released = pos - pos % release_step;
+        return true;
+    }
+
+    const record_index* index() const override
+    {
+        return idx.get();
+    }
+
+    // records are handed out zero copy, so only the pages decoding touches
+    // are read; readahead is turned off when records are long enough for
+    // that to skip whole pages
+    bool sparse(uint32_t head, uint32_t tail) override
+    {
+        const size_t page_len = sysconf(_SC_PAGESIZE);
+        size_t offset = pos;
+        size_t records = 0;
+        while (records < sparse_sample && map_len - offset >= sizeof(pcap_header_t))
+        {
+            pcap_header_t header;
+            memcpy(&header, map + offset, sizeof(header));
+            offset += sizeof(header) + header.len_capture;
+            ++records;
+        }
+        if (records && offset <= map_len && (offset - pos) / records >= head + tail + 2 * page_len)
+            madvise(const_cast<char*>(map), map_len, MADV_RANDOM);
+        return true;
+    }
+
+    // could a record header start at offset, following one captured at
+    // time secs
+    bool plausible_header(size_t offset, uint32_t secs) const
+    {
+        if (map_len - offset < sizeof(pcap_header_t))
+            return false;
+        pcap_header_t header;
+        memcpy(&header, map + offset, sizeof(header));
+        return header.tv_frac < (nanos ? 1000000000U : 1000000U)
+            && header.tv_secs >= first_secs
+            // within max_time_step of secs either way
+            && header.tv_secs - secs + max_time_step <= 2 * max_time_step
+            && header.len_capture >= min_record_len
+            && header.len_capture <= header.len_orig
+            && header.len_orig <= max_record_len
+            && map_len - offset - sizeof(header) >= header.len_capture;
+    }
+
+    int64_t resync(uint64_t offset) const override
+    {
+        for (size_t start = offset < sizeof(pcap_file_header_t) ? sizeof(pcap_file_header_t) : offset;
+             start < map_len; ++start)
+        {
+            // a boundary is accepted if a run of consistent headers follows
+            // it, or they lead exactly to the end of the file
+            pcap_header_t header;
+            memcpy(&header, map + start, std::min(sizeof(header), map_len - start));
+            size_t next = start;
+            unsigned chained = 0;
+            while (chained < resync_chain && next < map_len && plausible_header(next, header.tv_secs))
+            {
+                memcpy(&header, map + next, sizeof(header));
+                next += sizeof(header) + header.len_capture;
+                ++chained;
+            }
+            if (chained == resync_chain || (chained && next == map_len))
+                return start;
+        }
+        return -1;
+    }
+
+    read_record_t next(char* buffer, size_t buffer_len) override
+    {
+        if (limit - pos < sizeof(pcap_header_t))
+            return read_record_t(read_record_t::eof);
+        pcap_header_t header;
+        memcpy(&header, map + pos, sizeof(header));
+
+        read_record_t record = pcap_record(header, nanos);
+        if (record.len_capture > buffer_len
+            || limit - pos - sizeof(header) < record.len_capture)
+        {
+            pos = limit;
+            return record;
+        }
+        record.data = map + pos + sizeof(header);
+        record.status = read_record_t::ok;
+        pos += sizeof(header) + record.len_capture;
+
+        if (pos - released >= 2 * release_step)
+        {
+            // keep the previous step resident, records from it may still be in use
+            size_t end = pos - release_step;
+            end -= end % release_step;
+            madvise(const_cast<char*>(map) + released, end - released, MADV_DONTNEED);
+            released = end;
+        }
+        return record;
+    }
+};
+
+size_t record_reader::next_batch(record_batch& batch)
+{
+    return next_batch_loop(*this, batch);
+}
+
 std::unique_ptr<record_reader> record_reader::pcap(const read_options& opt)
 {
+    int fd = open(opt.source.c_str(), O_RDONLY);
+    struct stat stats;
+    if (fd != -1 && fstat(fd, &stats) == 0 && S_ISREG(stats.st_mode)
+        && decompress_buf::format(opt.source) == decompress_buf::none)
+    {
+        std::unique_ptr<pcap_mmap_reader> reader(new pcap_mmap_reader(fd, stats.st_size));
+        reader->idx = record_index::load(opt.source);
+        if (reader->idx && opt.verbose)
+            std::cout << "Using index " << record_index::path(opt.source) << " with "
+                      << reader->idx->keyframes.size() << " keyframes and "
+                      << reader->idx->checkpoints.size() << " checkpoints" << std::endl;
+        return std::move(reader);
+    }
+    if (fd != -1)
+        close(fd);
     return std::unique_ptr<record_reader>(new pcap_record_reader(opt.source));
 }
 
+/*
+ * Live capture from any interface through an AF_PACKET TPACKET_V3 ring of
+ * blocks shared with the kernel. Records in a batch point straight into the
+ * ring; a block is only handed back to the kernel once every batch with
+ * records in it has come back to be filled again, so batches can be passed
+ * between threads as with the other readers.
+ */
+struct af_packet_reader final : public record_reader
+{
+    // ring of blocks, each retired to the reader when full or once it has
+    // held packets this long
+    static const uint32_t block_len = 1 << 20;
+    static const uint32_t block_count = 64;
+    static const uint32_t block_timeout_ms = 10;
+    // longest to wait for a block before returning to the caller
+    static const int poll_ms = 10;
+
+    int fd;
+    char* ring;
+    int verbose;
+    // block being read, its next packet and the packets left in it
+    uint32_t current;
+    const tpacket3_hdr* packet;
+    uint32_t packets_left;
+    // batches holding records in each block, plus one while it is read
+    std::vector<unsigned> refs;
+    // blocks with records in each batch handed out
+    std::unordered_map<const record_batch*, std::vector<uint32_t>> held;
+    // kernel counters, which are reset each time they are read
+    uint64_t received;
+    uint64_t dropped;
+
+    af_packet_reader(const af_packet_reader&) = delete;
+    void operator=(const af_packet_reader&) = delete;
+
+    af_packet_reader(const read_options& opt)
+    : fd(-1)
+    , ring(nullptr)
+    , verbose(opt.verbose)
+    , current(0)
+    , packet(nullptr)
+    , packets_left(0)
+    , refs(block_count)
+    , held()
+    , received(0)
+    , dropped(0)
+    {
+        const unsigned ifindex = if_nametoindex(opt.source.c_str());
+        if (!ifindex)
+            throw std::invalid_argument(std::string("could not find interface"));
+
+        fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        if (fd == -1)
+            throw std::invalid_argument(std::string("could not open packet socket: ") + strerror(errno));
+
+        int version = TPACKET_V3;
+        tpacket_req3 req;
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = block_len;
+        req.tp_block_nr = block_count;
+        req.tp_frame_size = TPACKET_ALIGNMENT << 7;
+        req.tp_frame_nr = block_len / req.tp_frame_size * block_count;
+        req.tp_retire_blk_tov = block_timeout_ms;
+        if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1
+            || setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+            fail("could not set up packet ring");
+
+        void* p = mmap(nullptr, size_t(block_len) * block_count, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (p == MAP_FAILED)
+            fail("could not map packet ring");
+        ring = static_cast<char*>(p);
+
+        sockaddr_ll addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sll_family = AF_PACKET;
+        addr.sll_protocol = htons(ETH_P_ALL);
+        addr.sll_ifindex = ifindex;
+        if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1)
+            fail("could not bind to interface");
+
+        // membership ends with the socket, leaving the interface as it was
+        if (opt.promiscuous_mode)
+        {
+            packet_mreq mreq;
+            memset(&mreq, 0, sizeof(mreq));
+            mreq.mr_ifindex = ifindex;
+            mreq.mr_type = PACKET_MR_PROMISC;
+            if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1
+                && verbose)
+                std::cerr << "could not change to promiscuous mode\n";
+        }
+
+        if (opt.fanout >= 0)
+        {
+            // packets of a flow stay with one member of the group
+            const int fanout = (opt.fanout & 0xffff) | (PACKET_FANOUT_HASH << 16);
+            if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1)
+                fail("could not join fanout group");
+        }
+    }
+
+    virtual ~af_packet_reader()
+    {
+        if (verbose)
+        {
+            stats();
+            std::cout << "AF_PACKET: received " << received
+                      << ", dropped by the kernel " << dropped << std::endl;
+        }
+        if (ring)
+            munmap(ring, size_t(block_len) * block_count);
+        close(fd);
+    }
+
+    [[noreturn]] void fail(const char* what)
+    {
+        const std::string message = std::string(what) + ": " + strerror(errno);
+        if (ring)
+            munmap(ring, size_t(block_len) * block_count);
+        close(fd);
+        throw std::invalid_argument(message);
+    }
+
+    read_stats_t stats() override
+    {
+        tpacket_stats_v3 kernel;
+        socklen_t len = sizeof(kernel);
+        if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &kernel, &len) == 0)
+        {
+            received += kernel.tp_packets;
+            dropped += kernel.tp_drops;
+        }
+        read_stats_t stats;
+        stats.dropped = dropped;
+        return stats;
+    }
+
+    std::string type() const override
+    {
+        return "af_packet";
+    }
+
+    bool live() const override
+    {
+        return true;
+    }
+
+    tpacket_block_desc* block(uint32_t index) const
+    {
+        return reinterpret_cast<tpacket_block_desc*>(ring + size_t(index) * block_len);
+    }
+
+    void release(uint32_t index)
+    {
+        if (--refs[index])
+            return;
+        std::atomic_thread_fence(std::memory_order_release);
+        block(index)->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    }
+
+    // the next packet, false if none has arrived within poll_ms
+    bool next_packet()
+    {
+        if (packets_left)
+            return true;
+        if (packet)
+        {
+            // done with the block being read
+            packet = nullptr;
+            release(current);
+            current = (current + 1) % block_count;
+        }
+
+        tpacket_block_desc* desc = block(current);
+        if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+        {
+            pollfd pfd = { fd, POLLIN | POLLERR, 0 };
+            poll(&pfd, 1, poll_ms);
+            if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+                return false;
+        }
+        refs[current] = 1;
+        packets_left = desc->hdr.bh1.num_pkts;
+        packet = reinterpret_cast<const tpacket3_hdr*>(
+            reinterpret_cast<const char*>(desc) + desc->hdr.bh1.offset_to_first_pkt);
+        return packets_left || next_packet();
+    }
+
+    read_record_t take_packet()
+    {
+        read_record_t record(read_record_t::ok);
+        record.linktype = DLT_EN10MB;
+        record.data = reinterpret_cast<const char*>(packet) + packet->tp_mac;
+        record.clock_time = pstime_t(packet->tp_sec, packet->tp_nsec * 1000ULL, 9);
+        record.is_real_time = true;
+        record.len_capture = packet->tp_snaplen;
+        record.len_orig = packet->tp_len;
+        if (--packets_left)
+            packet = reinterpret_cast<const tpacket3_hdr*>(
+                reinterpret_cast<const char*>(packet) + packet->tp_next_offset);
+        return record;
+    }
+
+    // records are handed out zero copy, the blocks they are in stay with
+    // the reader until the batch comes back
+    size_t next_batch(record_batch& batch) override
+    {
+        std::vector<uint32_t>& blocks = held[&batch];
+        for (uint32_t index : blocks)
+            release(index);
+        blocks.clear();
+
+        batch.size = 0;
+        while (batch.size < batch.capacity && next_packet())
+        {
+            if (blocks.empty() || blocks.back() != current)
+            {
+                blocks.push_back(current);
+                ++refs[current];
+            }
+            read_record_t& record = batch.records[batch.size++] = take_packet();
+            // decoding may copy a record into its slot, as next() would
+            if (record.len_capture > batch.slot_len)
+            {
+                record.status = read_record_t::error;
+                break;
+            }
+        }
+        return batch.size;
+    }
+
+    read_record_t next(char* buffer, size_t buffer_len) override
+    {
+        if (!next_packet())
+            return read_record_t(read_record_t::again);
+        read_record_t record = take_packet();
+        if (record.len_capture > buffer_len)
+        {
+            record.status = read_record_t::error;
+            return record;
+        }
+        memcpy(buffer, record.data, record.len_capture);
+        record.data = buffer;
+        return record;
+    }
+};
+
+std::unique_ptr<record_reader> record_reader::af_packet(const read_options& opt)
+{
+    return std::unique_ptr<record_reader>(new af_packet_reader(opt));
+}
+
 #ifdef WITH_EXANIC
-struct exanic_reader : public record_reader
+struct exanic_reader final : public record_reader
 {
     exanic_t* exa;
     int devport;
     exanic_rx_t* rx;
     bool set_promiscuous;
     int verbose;
+    // the port's drop counter when the reader was created
+    uint32_t dropped_start;
+    // times the card lapped the reader, read by other threads for live
+    // counters, and the chunks it wrote meanwhile
+    std::atomic<uint64_t> lapped;
+    uint64_t lost_chunks;
+    // overflows since the last report, reported at most once a second
+    uint64_t report_overflows;
+    uint64_t report_chunks;
+    std::chrono::steady_clock::time_point last_report;
 
     exanic_reader(const exanic_reader&) = delete;
     void operator=(const exanic_reader&) = delete;
@@ -109,6 +656,12 @@ struct exanic_reader : public record_reader
     , rx(nullptr)
     , set_promiscuous(false)
     , verbose(opt.verbose)
+    , dropped_start(0)
+    , lapped(0)
+    , lost_chunks(0)
+    , report_overflows(0)
+    , report_chunks(0)
+    , last_report()
     {
         char device[24];
         if (exanic_find_port_by_interface_name(opt.source.c_str(), device, sizeof(device), &devport)
@@ -129,13 +682,36 @@ struct exanic_reader : public record_reader
             throw std::invalid_argument(std::string("could not acquire rx buffer"));
         }
 
+#ifdef WITH_EXANIC_EMULATOR
+        try
+        {
+            exanic_emulator_replay(rx, opt);
+        }
+        catch (...)
+        {
+            exanic_release_rx_buffer(rx);
+            exanic_release_handle(exa);
+            rx = nullptr;
+            exa = nullptr;
+            throw;
+        }
+#endif
+
         set_promiscuous = (opt.promiscuous_mode && !exanic_get_promiscuous_mode(exa, devport));
         if (set_promiscuous)
             set_promiscuous_mode(true);
+
+        exanic_port_stats_t port_stats;
+        if (exanic_get_port_stats(exa, devport, &port_stats) == 0)
+            dropped_start = port_stats.rx_dropped_count;
     }
     
     virtual ~exanic_reader()
     {
+        if (lapped)
+            std::cerr << "Overflow: lapped by the card " << lapped << " times, about "
+                      << lost_chunks << " chunks (" << lost_chunks * EXANIC_RX_CHUNK_PAYLOAD_SIZE
+                      << " bytes) lost" << std::endl;
         if (rx)
             exanic_release_rx_buffer(rx);
         if (exa)
@@ -173,11 +749,36 @@ struct exanic_reader : public record_reader
         close(fd);
     }
 
+    read_stats_t stats() override
+    {
+        read_stats_t stats;
+        exanic_port_stats_t port_stats;
+        if (exanic_get_port_stats(exa, devport, &port_stats) == 0)
+            stats.dropped = uint32_t(port_stats.rx_dropped_count - dropped_start);
+        stats.overflows = overflows();
+        return stats;
+    }
+
+    uint64_t overflows() const override
+    {
+        return lapped.load(std::memory_order_relaxed);
+    }
+
     std::string type() const override
     {
         return "exanic";
     }
 
+    bool live() const override
+    {
+        return true;
+    }
+
+    size_t next_batch(record_batch& batch) override
+    {
+        return next_batch_loop(*this, batch);
+    }
+
     int parse_device_port(const std::string& name, char* device, size_t max_len, int& port) const
     {
         size_t pos = name.find(':');
@@ -190,23 +791,70 @@ struct exanic_reader : public record_reader
         return 0;
     }
     
+    // count a lap by the card, given where the reader was waiting before it
+    // caught up, and report it if a second has passed since the last report
+    void overflowed(uint32_t chunk, uint8_t generation)
+    {
+        const int64_t laps = uint8_t(rx->generation - generation);
+        const int64_t lost = laps * EXANIC_RX_NUM_CHUNKS + int64_t(rx->next_chunk) - chunk;
+        // only this thread writes the count
+        lapped.store(lapped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        ++report_overflows;
+        if (lost > 0)
+        {
+            lost_chunks += lost;
+            report_chunks += lost;
+        }
+
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(1))
+        {
+            std::cerr << "Overflow: lapped by the card " << report_overflows << " times, about "
+                      << report_chunks << " chunks (" << report_chunks * EXANIC_RX_CHUNK_PAYLOAD_SIZE
+                      << " bytes) lost; " << lapped << " times in total" << std::endl;
+            report_overflows = 0;
+            report_chunks = 0;
+            last_report = now;
+        }
+    }
+
     read_record_t next(char* buffer, size_t buffer_len) override
     {
         uint32_t timestamp = 0;
         int status = 0;
+        const uint32_t chunk = rx->next_chunk;
+        const uint8_t generation = rx->generation;
         int offset = exanic_receive_frame_ex(rx, buffer, buffer_len, &timestamp, &status);
         int orig = offset;
         if (status == EXANIC_RX_FRAME_SWOVFL)
-            return read_record_t(read_record_t::overflow);
+        {
+            // the receive has caught up with the card, so carry on from
+            // there; keyframes from before a gap long enough to matter are
+            // no longer used once their clock time is too far behind
+            overflowed(chunk, generation);
+            return read_record_t(read_record_t::again);
+        }
         else if (status == EXANIC_RX_FRAME_TRUNCATED)
             ++orig; // dont have orig length
         else if (offset < 0)
+        {
+#ifdef WITH_EXANIC_EMULATOR
+            if (exanic_emulator_poll(rx))
+                return read_record_t(read_record_t::eof);
+#endif
             return read_record_t(read_record_t::again);
+        }
         
         read_record_t record(read_record_t::ok);
         record.linktype = DLT_EN10MB;
+        record.data = buffer;
         record.clock_time = ns_to_pstime(exanic_timestamp_to_counter(exa, timestamp));
+#ifdef WITH_EXANIC_EMULATOR
+        // the emulated clock follows the times of the capture replayed
+        record.is_real_time = false;
+#else
         record.is_real_time = true;
+#endif
         record.len_capture = offset;
         record.len_orig = orig;
         return record;
@@ -318,22 +966,27 @@ std::unique_ptr<record_reader> record_reader::make(const read_options& opt) noex
 {
     try
     {
-#ifdef WITH_EXANIC
         /*
          * Choose file reader if we can find the named file, or
          * if the arg ends with standard pcap extention.
          */
         const size_t src_len = opt.source.size();
         struct stat stats;
-        const bool is_file = (src_len>5 && opt.source.substr(src_len-5) == ".pcap")
+        const bool is_file = opt.source == "-"
+            || (src_len>5 && opt.source.substr(src_len-5) == ".pcap")
+            || decompress_buf::format(opt.source) != decompress_buf::none
             || (::stat(opt.source.c_str(), &stats) == 0);
         if (is_file)
             return record_reader::pcap(opt);
-        else
+#ifdef WITH_EXANIC
+        // ExaNIC ports by interface name or as device:port
+        char device[24];
+        int port;
+        if (opt.source.find(':') != std::string::npos
+            || !exanic_find_port_by_interface_name(opt.source.c_str(), device, sizeof(device), &port))
             return record_reader::exanic(opt);
-#else
-        return record_reader::pcap(opt);
 #endif
+        return record_reader::af_packet(opt);
     }
     catch (std::exception& e)
     {
@@ -341,4 +994,3 @@ std::unique_ptr<record_reader> record_reader::make(const read_options& opt) noex
         return std::unique_ptr<record_reader>();
     }
 }
-
@@ -10,7 +10,6 @@ struct read_record_t
 {
     enum status_t
     {
-        overflow = -3,
         error = -2,
         eof = -1,
         ok = 0,
@@ -23,6 +22,9 @@ struct read_record_t
     uint32_t len_orig;
     pstime_t clock_time;
     bool is_real_time;
+    // record contents, either the buffer passed to next() or memory owned
+    // by the reader (zero copy), valid until the following call to next()
+    const char* data;
     
     read_record_t(int s = read_record_t::error)
     : status(s)
@@ -31,17 +33,37 @@ struct read_record_t
     , len_orig(0)
     , clock_time(0, 0)
     , is_real_time(false)
+    , data(nullptr)
     {}
 };
 
+// losses of a live source so far
+struct read_stats_t
+{
+    // records the kernel or the card dropped before they could be read
+    uint64_t dropped = 0;
+    // times the reader fell a whole buffer behind the source
+    uint64_t overflows = 0;
+};
+
+struct record_batch;
+struct record_index;
+
 struct record_reader
 {
     // will throw on access rights issues or unsupported pcap
     // must be little endian, link type DLT_EN10MB (ethernet), version 2.4
+    // regular files are memory mapped, and an up to date index next to the
+    // file is loaded; pipes, - for stdin, and files ending .gz or .zst are
+    // streamed, read ahead and decompressed on a separate thread
     static std::unique_ptr<record_reader> pcap(const read_options& opt);
 
     // will throw on access rights issues or invalid interface name
     static std::unique_ptr<record_reader> exanic(const read_options& opt);
+
+    // capture from any interface through the kernel, needs CAP_NET_RAW;
+    // will throw on access rights issues or invalid interface name
+    static std::unique_ptr<record_reader> af_packet(const read_options& opt);
     
     // returns empty reader on error (prints any errors to std::cerr)
     static std::unique_ptr<record_reader> make(const read_options& opt) noexcept;
@@ -49,7 +71,48 @@ struct record_reader
     virtual ~record_reader() {}
     
     virtual std::string type() const = 0;
+
+    // live sources must be polled continuously to avoid losing records
+    virtual bool live() const { return false; }
+
+    // losses since the reader was created, from the thread reading it
+    virtual read_stats_t stats() { return read_stats_t(); }
+
+    // times the reader fell a whole buffer behind the source so far, may be
+    // called from any thread
+    virtual uint64_t overflows() const { return 0; }
     
+    // buffer may be left untouched if the reader can hand out record.data
+    // directly, records longer than buffer_len are reported as errors
     virtual read_record_t next(char* buffer, size_t buffer_len) = 0;
+
+    // byte offset of the next record, -1 if the source cannot seek
+    virtual int64_t tell() const { return -1; }
+
+    // length of a seekable source in bytes, -1 if the source cannot seek
+    virtual int64_t size() const { return -1; }
+
+    // continue reading at a record boundary previously returned by tell(),
+    // reporting eof at offset end if it is non zero; false if the source
+    // cannot seek
+    virtual bool seek(uint64_t offset, uint64_t end = 0) { return false; }
+
+    // offset of the first record boundary at or after offset, found from
+    // the consistency of the headers that follow; -1 if there is none or
+    // the source cannot seek
+    virtual int64_t resync(uint64_t offset) const { return -1; }
+
+    // read only the first head and last tail bytes of longer records, the
+    // middle of record.data is then unspecified unless the reader is zero
+    // copy; false if the source does not support it
+    virtual bool sparse(uint32_t head, uint32_t tail) { return false; }
+
+    // keyframe and time index of the source, null if there is none
+    virtual const record_index* index() const { return nullptr; }
+
+    // fill the batch using its payload slots as buffers, stopping after the
+    // first record that is not ok; returns the number of records in the batch,
+    // zero if there was nothing to read yet
+    virtual size_t next_batch(record_batch& batch);
 };
 
@@ -0,0 +1,80 @@
+#include "record_seek.hpp"
+#include "record_reader.hpp"
+#include "record_process.hpp"
+#include "record_index.hpp"
+#include <vector>
+
+// how far before start to look for a keyframe when bisecting: keyframes
+// come every second, and capture time can lag or lead hardware time
+static const pstime_t clock_lead(10, 0);
+
+// below this the remaining range is read through rather than bisected
+static const uint64_t bisect_min = 64 << 10;
+
+static bool seek_index(record_reader& reader, const record_index& index, const pstime_t& start)
+{
+    const record_index::checkpoint* point = index.find(start);
+    // the whole capture if start is before the first checkpoint
+    if (!point)
+        return true;
+    // decoding the keyframe itself gives the state for the checkpoint
+    if (point->keyframe >= 0)
+        return reader.seek(index.keyframes[point->keyframe].offset);
+    return reader.seek(point->offset);
+}
+
+bool seek_time(record_reader& reader, const pstime_t& start)
+{
+    const int64_t first = reader.tell();
+    const int64_t size = reader.size();
+    if (first < 0 || size < 0)
+        return false;
+    if (const record_index* index = reader.index())
+        return seek_index(reader, *index, start);
+
+    const pstime_t target = start.sec > clock_lead.sec ? start - clock_lead : pstime_t(0, 0);
+    std::vector<char> buffer(0x10080);
+    auto clock_before = [&](uint64_t offset)
+    {
+        reader.seek(offset);
+        read_record_t record = reader.next(buffer.data(), buffer.size());
+        return record.status == read_record_t::ok && record.clock_time < target;
+    };
+
+    // the record at lo is before the target, the first one at or after it
+    // starts no later than the first record boundary from hi
+    uint64_t lo = first;
+    uint64_t hi = size;
+    if (!clock_before(lo))
+        return reader.seek(first);
+    while (hi - lo > bisect_min)
+    {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        const int64_t boundary = reader.resync(mid);
+        if (boundary > int64_t(lo) && uint64_t(boundary) < hi && clock_before(boundary))
+            lo = boundary;
+        else
+            hi = mid;
+    }
+
+    // read through to the first record at or after the target, then on to
+    // the first keyframe so decoding starts with its state
+    reader.seek(lo);
+    int64_t from = -1;
+    while (true)
+    {
+        const int64_t offset = reader.tell();
+        read_record_t record = reader.next(buffer.data(), buffer.size());
+        if (record.status != read_record_t::ok)
+            break;
+        if (from == -1 && record.clock_time < target)
+            continue;
+        if (from == -1)
+            from = offset;
+        if (record_process::is_keyframe(record))
+            return reader.seek(offset);
+        if (record.clock_time > start)
+            break;
+    }
+    return reader.seek(from == -1 ? lo : from);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "pstime.hpp"
+
+struct record_reader;
+
+/*
+ * Position a seekable reader so that decoding from there sees every record
+ * with a hardware time at or after start, beginning at a keyframe before it
+ * where there is one. The reader's index is used if it has one, otherwise
+ * the file is bisected on capture time, which is assumed to be within a few
+ * seconds of hardware time.
+ * Returns false, leaving the reader where it was, if it cannot seek.
+ */
+bool seek_time(record_reader& reader, const pstime_t& start);
@@ -0,0 +1,150 @@
+#include "record_sort.hpp"
+#include <algorithm>
+#include <string.h>
+
+// heap order, earliest time first then earliest arrival
+static bool later(const pstime_t& a_key, uint64_t a_seq, const pstime_t& b_key, uint64_t b_seq)
+{
+    return b_key < a_key || (!(a_key < b_key) && a_seq > b_seq);
+}
+
+record_sorter::record_sorter(uint64_t window_ns, size_t batch_len, const sink_t& sink)
+: window_(ns_to_pstime(window_ns))
+, sink_(sink)
+, slabs_()
+, heap_()
+, out_(batch_len, 0)
+, out_blocks_(batch_len)
+, stopped_(false)
+, seq_(0)
+, latest_(0, 0)
+, released_(0, 0)
+, late_(0)
+, forced_(0)
+, peak_held_(0)
+, held_bytes_(0)
+, peak_bytes_(0)
+{
+    out_.size = 0;
+}
+
+char* record_sorter::copy_payload(const read_record_t& record)
+{
+    char* block = slabs_.allocate(record.len_capture);
+    if (record.len_capture)
+        memcpy(block, record.data, record.len_capture);
+    held_bytes_ += record.len_capture;
+    peak_bytes_ = std::max(peak_bytes_, held_bytes_);
+    return block;
+}
+
+bool record_sorter::pass_on(const read_record_t& record, const record_time_t& time, char* block)
+{
+    if (out_.size == out_.capacity && !write_out())
+        return false;
+    out_.records[out_.size] = record;
+    out_.times[out_.size] = time;
+    out_blocks_[out_.size] = block;
+    if (block)
+        out_.records[out_.size].data = block;
+    ++out_.size;
+    return true;
+}
+
+bool record_sorter::release_earliest()
+{
+    auto order = [](const held_record& a, const held_record& b)
+                 { return later(a.key, a.seq, b.key, b.seq); };
+    std::pop_heap(heap_.begin(), heap_.end(), order);
+    const held_record& held = heap_.back();
+    released_ = held.key;
+    const bool more = pass_on(held.record, held.time, const_cast<char*>(held.record.data));
+    heap_.pop_back();
+    return more;
+}
+
+bool record_sorter::write_out()
+{
+    if (!out_.size)
+        return !stopped_;
+    if (!sink_(out_))
+        stopped_ = true;
+    for (size_t i = 0; i < out_.size; ++i)
+    {
+        if (out_blocks_[i])
+        {
+            slabs_.free(out_blocks_[i], out_.records[i].len_capture);
+            held_bytes_ -= out_.records[i].len_capture;
+        }
+    }
+    out_.size = 0;
+    return !stopped_;
+}
+
+bool record_sorter::operator()(record_batch& batch)
+{
+    auto order = [](const held_record& a, const held_record& b)
+                 { return later(a.key, a.seq, b.key, b.seq); };
+    for (size_t i = 0; i < batch.size && !stopped_; ++i)
+    {
+        const read_record_t& record = batch.records[i];
+        const record_time_t& time = batch.times[i];
+        if (record.status != read_record_t::ok || time.status < 0)
+        {
+            // the end of the input, or the sink stops here
+            return flush() && pass_on(record, time, nullptr) && write_out();
+        }
+
+        const bool decoded = time.status == record_time_t::ok;
+        if (decoded && time.hw_time < released_)
+        {
+            ++late_;
+            if (!pass_on(record, time, copy_payload(record)))
+                return false;
+            continue;
+        }
+
+        held_record held;
+        held.key = decoded ? time.hw_time : latest_;
+        held.seq = seq_++;
+        held.record = record;
+        held.record.data = copy_payload(record);
+        held.time = time;
+        heap_.push_back(held);
+        std::push_heap(heap_.begin(), heap_.end(), order);
+        peak_held_ = std::max(peak_held_, heap_.size());
+        if (latest_ < held.key)
+            latest_ = held.key;
+
+        while (!heap_.empty() && heap_.front().key + window_ < latest_)
+        {
+            if (!release_earliest())
+                return false;
+        }
+        if (heap_.size() > max_held)
+        {
+            ++forced_;
+            if (!release_earliest())
+                return false;
+        }
+    }
+    return write_out();
+}
+
+bool record_sorter::flush()
+{
+    while (!heap_.empty())
+    {
+        if (!release_earliest())
+            return false;
+    }
+    return write_out();
+}
+
+void record_sorter::print_stats(std::ostream& os) const
+{
+    os << "Sort: window " << window_.ns() << " ns"
+       << ", peak held " << peak_held_ << " records of " << peak_bytes_ << " bytes"
+       << ", late " << late_
+       << ", passed on early " << forced_ << std::endl;
+}
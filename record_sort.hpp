@@ -0,0 +1,75 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <vector>
+#include "pstime.hpp"
+#include "record_batch.hpp"
+#include "slab_allocator.hpp"
+
+/*
+ * Reorders decoded records by hardware time within a window, for streams
+ * mirrored from several ports that arrive slightly out of order.
+ * Records are held in a bounded min heap with their payloads copied to a
+ * slab allocator, and are passed on in time order once they are further
+ * behind the latest time seen than the window. A record arriving after a
+ * later one has already been passed on is late, it is passed on at once.
+ * Records that did not decode are held at the latest time seen so they
+ * stay near their neighbours; the end of input, read errors and
+ * unrecoverable records pass on everything held first.
+ */
+struct record_sorter
+{
+    using sink_t = std::function<bool(record_batch&)>;
+
+    // window_ns is the most records may be out of order
+    record_sorter(uint64_t window_ns, size_t batch_len, const sink_t& sink);
+
+    record_sorter(const record_sorter&) = delete;
+    void operator=(const record_sorter&) = delete;
+
+    // as a batch sink, false once the sink has stopped
+    bool operator()(record_batch& batch);
+
+    // pass on everything held, for the end of input; false once the sink
+    // has stopped
+    bool flush();
+
+    void print_stats(std::ostream& os) const;
+
+private:
+    // most records held, the earliest is passed on early beyond this
+    static const size_t max_held = 1 << 20;
+
+    struct held_record
+    {
+        pstime_t key = pstime_t(0, 0);
+        // arrival order, for a stable sort
+        uint64_t seq = 0;
+        read_record_t record = read_record_t();
+        record_time_t time = record_time_t();
+    };
+
+    char* copy_payload(const read_record_t& record);
+    bool pass_on(const read_record_t& record, const record_time_t& time, char* block);
+    bool release_earliest();
+    bool write_out();
+
+    const pstime_t window_;
+    const sink_t sink_;
+    slab_allocator slabs_;
+    std::vector<held_record> heap_;
+    // records passed on, with payloads to free once the sink has them,
+    // null for payloads not held here
+    record_batch out_;
+    std::vector<char*> out_blocks_;
+    bool stopped_;
+    uint64_t seq_;
+    pstime_t latest_;
+    pstime_t released_;
+    uint64_t late_;
+    uint64_t forced_;
+    size_t peak_held_;
+    size_t held_bytes_;
+    size_t peak_bytes_;
+};
@@ -1,27 +1,37 @@
 #include "record_writer.hpp"
 #include "record_reader.hpp"
 #include "record_process.hpp"
+#include "record_batch.hpp"
 #include "pcap_common.hpp"
+#include "hexdump.hpp"
+#include "buffered_file.hpp"
 #include <fstream>
 #include <sstream>
 #include <iostream>
-#include <iomanip>
 #include <ctime>
 #include <stdexcept>
 #include <stdio.h>
-#include <ctype.h>
+#include <time.h>
 
-struct pcap_writer : public record_writer
+/*
+ * A pcap file is written through a buffered_file, so records are copied into
+ * large blocks written from a background thread, fragments go to a stream.
+ */
+struct pcap_writer final : public record_writer
 {
     const write_options options;
-    std::ofstream os;
+    std::unique_ptr<buffered_file> file;
+    std::ostream* os;
+    bool ok;
 
     pcap_writer(const write_options& opt)
     : options(opt)
-    , os(opt.dest, std::ofstream::trunc)
+    , file(new buffered_file(opt.dest, opt.pcap_buffer_len, opt.direct_io))
+    , os(nullptr)
+    , ok(true)
     {
-        if (!os.good())
-            throw std::invalid_argument(std::string("could not create pcap file"));
+        if (options.direct_io && !file->direct() && options.verbose)
+            std::cerr << "Direct io not supported for " << opt.dest << ", using buffered io" << std::endl;
         pcap_file_header_t header;
         header.version_major = 2;
         header.version_minor = 4;
@@ -30,16 +40,69 @@ struct pcap_writer : public record_writer
         header.thiszone = 0;
         header.sigfigs = 0;
         header.snaplen = 0xffff;
-        os.write((const char*)&header, sizeof(header));
-        if (!os.good())
-            throw std::invalid_argument(std::string("could not write to pcap file"));
+        put(&header, sizeof(header));
     }
 
+    // fragment, records only without the file header
+    pcap_writer(const write_options& opt, std::ostream& out)
+    : options(opt)
+    , file()
+    , os(&out)
+    , ok(true)
+    {}
+
+    pcap_writer(const pcap_writer&) = delete;
+    void operator=(const pcap_writer&) = delete;
+
     std::string type() const override { return "pcap"; }
 
-    int write(const record_time_t& time, const read_record_t& record, const char* buffer)
+    std::unique_ptr<record_writer> fragment(std::ostream& out) const override
     {
-        if (!os.good())
+        return std::unique_ptr<record_writer>(new pcap_writer(options, out));
+    }
+
+    void put(const void* data, size_t len)
+    {
+        if (file)
+            ok = file->write(data, len);
+        else
+            ok = os->write(static_cast<const char*>(data), len).good();
+    }
+
+    int append(const std::string& data) override
+    {
+        put(data.data(), data.size());
+        return ok? 0 : -1;
+    }
+
+    int flush() override
+    {
+        if (file)
+            ok = file->flush();
+        else
+            ok = os->flush().good();
+        return ok? 0 : -1;
+    }
+
+    int close() override
+    {
+        // the tail, the truncation of preallocated space and any failed
+        // background write are only known once the file is closed
+        if (file)
+            ok = file->close() && ok;
+        else
+            ok = os->flush().good() && ok;
+        return ok? 0 : -1;
+    }
+
+    size_t write_batch(record_batch& batch, size_t begin, size_t end, size_t limit) override
+    {
+        return write_batch_loop(*this, batch, begin, end, limit);
+    }
+
+    int write(const record_time_t& time, const read_record_t& record, const char* buffer) override
+    {
+        if (!ok)
             return -1;
         if (time.is_keyframe && !options.write_keyframes)
             return +1;
@@ -53,119 +116,249 @@ struct pcap_writer : public record_writer
                 header.tv_frac /= 1000;
             header.len_capture = record.len_capture;
             header.len_orig = record.len_orig;
-            os.write((const char*)&header, sizeof(header));
-            os.write(buffer, header.len_capture);
+            put(&header, sizeof(header));
+            put(buffer, header.len_capture);
         }
-        return os.good()? 0 : -1;
+        return ok? 0 : -1;
     }
 };
 
-struct text_writer : public record_writer
+/*
+ * Text output is formatted by hand into a large buffer, which is written out
+ * once it fills up, after flush_interval_ms, or on an explicit flush.
+ */
+struct text_writer final : public record_writer
 {
+    // output is written once this much is buffered
+    static const size_t flush_len = 4 << 20;
+
+    // strftime output for the last second formatted, with the trailing '.'
+    struct date_cache
+    {
+        time_t sec = -1;
+        std::string prefix = std::string();
+    };
+
     const write_options options;
-    std::ofstream os;
+    std::ofstream file;
+    std::ostream& os;
+    std::string out;
+    date_cache hw_dates;
+    date_cache clock_dates;
+    uint64_t last_flush_ns;
 
     text_writer(const write_options& opt)
     : options(opt)
-    , os()
+    , file()
+    , os(file)
+    , out()
+    , hw_dates()
+    , clock_dates()
+    , last_flush_ns(now_ns())
     {
         if (options.dest == "-")
-            os.open("/dev/stdout");
+            file.open("/dev/stdout");
         else
-            os.open(options.dest);
+            file.open(options.dest);
         if (!os.good())
             throw std::invalid_argument(std::string("could not open destination for writing"));
+        out.reserve(flush_len + 0x10000);
+    }
+
+    text_writer(const write_options& opt, std::ostream& out_stream)
+    : options(opt)
+    , file()
+    , os(out_stream)
+    , out()
+    , hw_dates()
+    , clock_dates()
+    , last_flush_ns(now_ns())
+    {
+        out.reserve(flush_len + 0x10000);
+    }
+
+    virtual ~text_writer()
+    {
+        flush();
+    }
+
+    static uint64_t now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
     }
 
     std::string type() const override { return "text"; }
 
-    void write_time(pstime_t time)
+    std::unique_ptr<record_writer> fragment(std::ostream& out_stream) const override
+    {
+        return std::unique_ptr<record_writer>(new text_writer(options, out_stream));
+    }
+
+    int flush() override
     {
-        std::time_t ts = time.sec;
-        std::tm tm = *std::localtime(&ts);
-        char buffer[128];
-        std::size_t written = strftime(buffer, 128, options.text_date_format.c_str(), &tm);
-        if (!written)
-            throw std::invalid_argument(std::string("bad time format string"));
-        os << buffer << '.';
+        if (!out.empty())
+        {
+            os.write(out.data(), out.size());
+            out.clear();
+        }
+        os.flush();
+        last_flush_ns = now_ns();
+        return os.good()? 0 : -1;
+    }
+
+    int close() override
+    {
+        int ret = flush();
+        if (file.is_open())
+        {
+            file.close();
+            if (file.fail())
+                ret = -1;
+        }
+        return ret;
+    }
+
+    int append(const std::string& data) override
+    {
+        flush();
+        os.write(data.data(), data.size());
+        os.flush();
+        return os.good()? 0 : -1;
+    }
+
+    int maybe_flush() override
+    {
+        if (now_ns() - last_flush_ns < options.flush_interval_ms * 1000000ULL)
+            return 0;
+        return flush();
+    }
+
+    size_t write_batch(record_batch& batch, size_t begin, size_t end, size_t limit) override
+    {
+        const size_t handled = write_batch_loop(*this, batch, begin, end, limit);
+        maybe_flush();
+        return handled;
+    }
+
+    // right aligned in at least width characters
+    void put_uint(uint64_t value, unsigned width, char fill)
+    {
+        char digits[20];
+        unsigned n = 0;
+        do
+        {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+        if (width > n)
+            out.append(width - n, fill);
+        while (n)
+            out.push_back(digits[--n]);
+    }
+
+    void write_time(pstime_t time, date_cache& dates)
+    {
+        if (time.sec != dates.sec)
+        {
+            std::time_t ts = time.sec;
+            // fragments may be written on several threads at once
+            std::tm tm;
+            localtime_r(&ts, &tm);
+            char buffer[128];
+            std::size_t written = strftime(buffer, 128, options.text_date_format.c_str(), &tm);
+            if (!written)
+                throw std::invalid_argument(std::string("bad time format string"));
+            dates.sec = time.sec;
+            dates.prefix.assign(buffer, written);
+            dates.prefix.push_back('.');
+        }
+        out.append(dates.prefix);
         uint64_t frac = time.psec;
         for (unsigned i = 12; i > time.precision; --i)
             frac /= 10;
-        os << std::setfill('0') << std::setw(time.precision) << frac << std::setfill(' ');
+        put_uint(frac, time.precision, '0');
     }
 
-    void write_packet(const char* buffer, size_t len)
+    // signed and rounded to the precision of the difference, like "%+.*f"
+    void write_diff(const pstime_t& diff)
     {
-        os << std::setfill('0');
-        os << std::hex;
-        for (size_t i=0; i<len; i+=16)
+        const pstime_t magnitude = diff.abs();
+        uint64_t sec = magnitude.sec;
+        uint64_t unit = 1;
+        for (unsigned i = 12; i > diff.precision; --i)
+            unit *= 10;
+        // ties to even, as printf rounds an exact decimal
+        uint64_t frac = magnitude.psec / unit;
+        const uint64_t rest = magnitude.psec % unit;
+        if (rest > unit / 2 || (rest == unit / 2 && unit > 1 && (frac & 1)))
+            ++frac;
+        if (frac * unit == pstime_t::psec_per_sec)
         {
-            size_t next = i+16;
-            os << "    ";
-            os << std::setw(4) << i << ':';
-            for (size_t k=i; k<next; ++k)
-            {
-                if (k%4 == 0)
-                    os << ' ';
-                uint8_t c = buffer[k];
-                if (k<len)
-                    os << std::setw(2) << (int)c;
-                else
-                    os << "  ";
-            }
-            os << ' ';
-            for (size_t k=i; k<next; ++k)
-            {
-                if (k%8 == 0)
-                    os << ' ';
-                char c = buffer[k];
-                if (isprint(c))
-                    os << c;
-                else if (k<len)
-                    os << '.';
-            }
-            os << "\n";
+            ++sec;
+            frac = 0;
+        }
+        out.push_back(diff.negative() ? '-' : '+');
+        put_uint(sec, 1, '0');
+        if (diff.precision)
+        {
+            out.push_back('.');
+            put_uint(frac, diff.precision, '0');
         }
-        os << std::dec;
-        os.flush();
     }
 
-    int write(const record_time_t& time, const read_record_t& record, const char* buffer)
+    void write_packet(const char* buffer, size_t len)
+    {
+        // buffer may be a zero copy view, the kernel never looks past len
+        const size_t start = out.size();
+        out.resize(start + hexdump_len(len));
+        out.resize(start + hexdump(buffer, len, &out[start]));
+    }
+
+    int write(const record_time_t& time, const read_record_t& record, const char* buffer) override
     {
         if (!os.good())
             return -1;
         if (time.is_keyframe && !options.write_keyframes)
             return +1;
 
-        write_time(time.hw_time);
+        write_time(time.hw_time, hw_dates);
         if (options.write_clock_times)
         {
-            os << "  (";
-            write_time(record.clock_time);
+            out.append("  (");
+            write_time(record.clock_time, clock_dates);
             if (time.hw_time && record.clock_time)
             {
-                pstime_t diff = time.hw_time - record.clock_time;
-                os << std::setprecision(diff.precision) << std::fixed << std::showpos;
-                os << " " << double(diff);
-                os << std::noshowpos;
+                out.push_back(' ');
+                write_diff(time.hw_time - record.clock_time);
             }
-            os << ")";
+            out.push_back(')');
         }
         if (time.device_id != -1 && time.port != -1)
         {
-            os << "  (" << std::setfill('0')
-               << std::setw(3) << time.device_id
-               << ":"
-               << std::setw(3) << time.port
-               << ")" << std::setfill(' ');
+            out.append("  (");
+            put_uint(time.device_id, 3, '0');
+            out.push_back(':');
+            put_uint(time.port, 3, '0');
+            out.push_back(')');
         }
-        os << " " << std::setw(5) << record.len_capture << " bytes" << std::endl;
+        out.push_back(' ');
+        put_uint(record.len_capture, 5, ' ');
+        out.append(" bytes\n");
         if (options.write_packet)
             write_packet(buffer, record.len_capture);
+        if (out.size() >= flush_len)
+            return flush();
         return 0;
     }
 };
 
+size_t record_writer::write_batch(record_batch& batch, size_t begin, size_t end, size_t limit)
+{
+    return write_batch_loop(*this, batch, begin, end, limit);
+}
+
 std::unique_ptr<record_writer> record_writer::pcap(const write_options& opt)
 {
     return std::unique_ptr<record_writer>(new pcap_writer(opt));
@@ -1,10 +1,12 @@
 #pragma once
 
 #include <memory>
+#include <ostream>
 #include "options.hpp"
 
 struct read_record_t;
 struct record_time_t;
+struct record_batch;
 
 struct record_writer
 {
@@ -20,8 +22,32 @@ struct record_writer
     virtual ~record_writer() {}
     
     virtual std::string type() const = 0;
+
+    // writer of the same type and options formatting into out without any
+    // file header, so its output can be passed to append() in order
+    virtual std::unique_ptr<record_writer> fragment(std::ostream& out) const = 0;
+
+    // add output produced by a fragment writer, zero on success
+    virtual int append(const std::string& data) = 0;
+
+    // write out anything buffered, zero on success
+    virtual int flush() = 0;
+
+    // write out everything and close the output, reporting any error the
+    // final writes hit, zero on success; nothing may be written after
+    virtual int close() { return flush(); }
+
+    // write out anything held longer than the flush interval, for callers
+    // to use while no records arrive; zero on success
+    virtual int maybe_flush() { return 0; }
     
     // return zero on success, negative for an error, positive if the record is ignored
     virtual int write(const record_time_t& time, const read_record_t& record, const char* buffer) = 0;
+
+    // write the records in [begin, end) of the batch that decoded ok, keeping
+    // each write() result in batch.results; stops after an error or once limit
+    // records have been written (0 for no limit)
+    // returns the index after the last record handled
+    virtual size_t write_batch(record_batch& batch, size_t begin, size_t end, size_t limit);
 };
 
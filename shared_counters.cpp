@@ -0,0 +1,148 @@
+#include "shared_counters.hpp"
+#include <stdexcept>
+#include <thread>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static std::string shm_path(const std::string& name)
+{
+    if (name.empty() || name.find('/') != std::string::npos)
+        throw std::runtime_error("counters name must be non empty without any /");
+    return "/" + name;
+}
+
+std::unique_ptr<shared_counters> shared_counters::create(const std::string& name)
+{
+    const std::string path = shm_path(name);
+    shm_unlink(path.c_str());
+    const int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd == -1)
+        throw std::runtime_error("could not create counters: " + std::string(strerror(errno)));
+
+    void* p = MAP_FAILED;
+    if (ftruncate(fd, sizeof(layout)) == 0)
+        p = mmap(nullptr, sizeof(layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int err = errno;
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        shm_unlink(path.c_str());
+        throw std::runtime_error("could not map counters: " + std::string(strerror(err)));
+    }
+
+    // the segment starts zeroed, the header is written last so a reader
+    // attaching early sees no magic rather than a partial header
+    layout* l = static_cast<layout*>(p);
+    l->version = version;
+    l->counters = counters;
+    l->pid = getpid();
+    std::atomic_thread_fence(std::memory_order_release);
+    l->magic = magic;
+    return std::unique_ptr<shared_counters>(new shared_counters(name, l, true));
+}
+
+std::unique_ptr<shared_counters> shared_counters::open(const std::string& name)
+{
+    const std::string path = shm_path(name);
+    const int fd = shm_open(path.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        throw std::runtime_error("could not open counters /dev/shm" + path + ": "
+                                 + strerror(errno));
+
+    void* p = MAP_FAILED;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(layout))
+        p = mmap(nullptr, sizeof(layout), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("could not map counters /dev/shm" + path);
+
+    layout* l = static_cast<layout*>(p);
+    if (l->magic != magic || l->version != version || l->counters != counters)
+    {
+        munmap(p, sizeof(layout));
+        throw std::runtime_error("counters /dev/shm" + path + " are not from this version");
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return std::unique_ptr<shared_counters>(new shared_counters(name, l, false));
+}
+
+shared_counters::shared_counters(const std::string& name, layout* mapped, bool owner)
+: name_(name)
+, layout_(mapped)
+, owner_(owner)
+, sequence_(0)
+{}
+
+shared_counters::~shared_counters()
+{
+    if (owner_)
+        layout_->ended.store(1, std::memory_order_release);
+    munmap(layout_, sizeof(layout));
+    if (owner_)
+        shm_unlink(shm_path(name_).c_str());
+}
+
+void shared_counters::begin()
+{
+    layout_->sequence.store(++sequence_, std::memory_order_relaxed);
+    // the odd sequence must be visible before any of the stores after it
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void shared_counters::end()
+{
+    layout_->sequence.store(++sequence_, std::memory_order_release);
+}
+
+bool shared_counters::read(uint64_t (&values)[counters]) const
+{
+    // an update takes a few stores, so one that outlasts this many tries
+    // will not finish
+    for (unsigned tries = 0; tries < 10000; ++tries)
+    {
+        const uint64_t before = layout_->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < counters; ++i)
+            values[i] = layout_->slots[i].value.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (layout_->sequence.load(std::memory_order_relaxed) == before)
+            return true;
+    }
+    return false;
+}
+
+bool shared_counters::ended() const
+{
+    // a publisher that crashed never marks its counts final
+    return layout_->ended.load(std::memory_order_acquire)
+        || (kill(layout_->pid, 0) == -1 && errno == ESRCH);
+}
+
+const char* shared_counters::name(size_t counter)
+{
+    switch (counter)
+    {
+    case packets_in:    return "packets in";
+    case packets_out:   return "packets out";
+    case bytes_in:      return "bytes in";
+    case bytes_out:     return "bytes out";
+    case key_frames:    return "key frames";
+    case errors:        return "errors";
+    case overflows:     return "overflows";
+    default:
+        break;
+    }
+    if (counter >= status_errors && counter < counters)
+        return record_time_t(int(counter - status_errors) + first_status).status_str();
+    return "unknown";
+}
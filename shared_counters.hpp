@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include "record_process.hpp"
+
+/*
+ * Live counters of a running decoder in POSIX shared memory, for
+ * timestamp-decoder-stats to read without stopping it. A single thread
+ * publishes: it makes the sequence number odd, stores each counter relaxed
+ * into a slot of its own cache line, then makes the sequence even again.
+ * Readers retry a copy taken while the sequence was odd or that it changed
+ * under (a seqlock), so the publisher never waits on them.
+ */
+struct shared_counters
+{
+    // records that decoded with each record_time_t::status_t other than ok
+    static const int first_status = record_time_t::unsupported_keyframe;
+    static const int last_status = record_time_t::unknown_format;
+    static const size_t statuses = last_status - first_status + 1;
+
+    enum counter_t
+    {
+        packets_in,
+        packets_out,
+        bytes_in,
+        bytes_out,
+        key_frames,
+        errors,
+        overflows,
+        status_errors,
+        counters = status_errors + statuses
+    };
+
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "counters must be lock free to be shared");
+
+    // creates /dev/shm/<name>, replacing one left by an earlier run, and
+    // removes it again once destroyed; will throw std::runtime_error
+    static std::unique_ptr<shared_counters> create(const std::string& name);
+
+    // attaches to the counters of a running decoder read only; will throw
+    // std::runtime_error if there are none or they are of another version
+    static std::unique_ptr<shared_counters> open(const std::string& name);
+
+    ~shared_counters();
+
+    shared_counters(const shared_counters&) = delete;
+    void operator=(const shared_counters&) = delete;
+
+    // publisher only: stores between begin and end are seen together
+    void begin();
+    void store(size_t counter, uint64_t value)
+    {
+        layout_->slots[counter].value.store(value, std::memory_order_relaxed);
+    }
+    void end();
+
+    // a consistent copy of all counters, false if none could be taken,
+    // as when the publisher was killed part way through an update
+    bool read(uint64_t (&values)[counters]) const;
+
+    // true once the publisher has finished or its process has gone
+    bool ended() const;
+
+    static const char* name(size_t counter);
+
+private:
+    struct layout
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t counters;
+        int32_t pid;
+        // set by the publisher once the counts are final
+        std::atomic<uint32_t> ended;
+        alignas(64) std::atomic<uint64_t> sequence;
+        struct alignas(64) slot
+        {
+            std::atomic<uint64_t> value;
+        } slots[shared_counters::counters];
+    };
+
+    static const uint32_t magic = 0x54534443;
+    static const uint32_t version = 1;
+
+    shared_counters(const std::string& name, layout* mapped, bool owner);
+
+    const std::string name_;
+    layout* const layout_;
+    // the creator removes the segment
+    const bool owner_;
+    uint64_t sequence_;
+};
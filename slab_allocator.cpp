@@ -0,0 +1,49 @@
+#include "slab_allocator.hpp"
+#include <string.h>
+
+slab_allocator::slab_allocator(size_t slab_len)
+: slab_len_(slab_len)
+, slabs_()
+, next_(nullptr)
+, left_(0)
+, free_()
+{}
+
+unsigned slab_allocator::size_class(size_t len)
+{
+    unsigned c = min_class;
+    while ((size_t(1) << c) < len)
+        ++c;
+    return c;
+}
+
+char* slab_allocator::allocate(size_t len)
+{
+    const unsigned c = size_class(len);
+    char* block = free_[c];
+    if (block)
+    {
+        memcpy(&free_[c], block, sizeof(char*));
+        return block;
+    }
+
+    const size_t block_len = size_t(1) << c;
+    if (left_ < block_len)
+    {
+        // the rest of the old slab is abandoned, it is less than a block
+        slabs_.emplace_back(new char[slab_len_]);
+        next_ = slabs_.back().get();
+        left_ = slab_len_;
+    }
+    block = next_;
+    next_ += block_len;
+    left_ -= block_len;
+    return block;
+}
+
+void slab_allocator::free(char* block, size_t len)
+{
+    const unsigned c = size_class(len);
+    memcpy(block, &free_[c], sizeof(char*));
+    free_[c] = block;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <stddef.h>
+
+/*
+ * Allocator for short lived record payloads. Blocks are rounded up to a
+ * power of two size class and carved from large slabs, freed blocks go on
+ * a free list per class and are reused, so steady state use does no
+ * allocation at all. Memory is only returned when the allocator is
+ * destroyed.
+ */
+struct slab_allocator
+{
+    explicit slab_allocator(size_t slab_len = 4 << 20);
+
+    slab_allocator(const slab_allocator&) = delete;
+    void operator=(const slab_allocator&) = delete;
+
+    // len must be no more than slab_len
+    char* allocate(size_t len);
+
+    // len as given to allocate()
+    void free(char* block, size_t len);
+
+    // bytes of slabs allocated
+    size_t reserved() const { return slabs_.size() * slab_len_; }
+
+private:
+    // smallest class is 1 << min_class bytes
+    static const unsigned min_class = 6;
+    static const unsigned classes = 32;
+
+    static unsigned size_class(size_t len);
+
+    const size_t slab_len_;
+    std::vector<std::unique_ptr<char[]>> slabs_;
+    // unused part of the newest slab
+    char* next_;
+    size_t left_;
+    // freed blocks of each class, linked through their first bytes
+    char* free_[classes];
+};
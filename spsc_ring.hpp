@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+
+/*
+ * Lock free single producer, single consumer ring of values.
+ * The producer keeps an occupancy high watermark and a count of pushes
+ * that found the ring full, so stalls between stages can be reported.
+ */
+template <typename T>
+struct spsc_ring
+{
+private:
+    const size_t mask_;
+    std::vector<T> slots_;
+
+    // consumer side
+    alignas(64) std::atomic<size_t> tail_;
+    size_t head_cache_;
+
+    // producer side
+    alignas(64) std::atomic<size_t> head_;
+    size_t tail_cache_;
+    std::atomic<size_t> high_watermark_;
+    std::atomic<size_t> full_count_;
+
+    static size_t round_up(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+public:
+    // capacity is rounded up to a power of two
+    explicit spsc_ring(size_t capacity)
+    : mask_(round_up(capacity) - 1)
+    , slots_(mask_ + 1)
+    , tail_(0)
+    , head_cache_(0)
+    , head_(0)
+    , tail_cache_(0)
+    , high_watermark_(0)
+    , full_count_(0)
+    {}
+
+    spsc_ring(const spsc_ring&) = delete;
+    void operator=(const spsc_ring&) = delete;
+
+    size_t capacity() const { return mask_ + 1; }
+
+    bool push(const T& value)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_cache_ > mask_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head - tail_cache_ > mask_)
+            {
+                full_count_.store(full_count_.load(std::memory_order_relaxed) + 1,
+                                  std::memory_order_relaxed);
+                return false;
+            }
+        }
+        slots_[head & mask_] = value;
+        head_.store(head + 1, std::memory_order_release);
+
+        // the cached tail only moves when the ring looks full, so take the
+        // consumer's position now for how full the ring really is
+        tail_cache_ = tail_.load(std::memory_order_acquire);
+        const size_t used = head + 1 - tail_cache_;
+        if (used > high_watermark_.load(std::memory_order_relaxed))
+            high_watermark_.store(used, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool pop(T& value)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_cache_)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail == head_cache_)
+                return false;
+        }
+        value = slots_[tail & mask_];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // may be called from any thread, the result is approximate
+    size_t occupancy() const
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return occupancy() == 0; }
+
+    size_t high_watermark() const { return high_watermark_.load(std::memory_order_relaxed); }
+
+    size_t full_count() const { return full_count_.load(std::memory_order_relaxed); }
+};